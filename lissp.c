@@ -1,4 +1,27 @@
+/* mapping files and executable memory need more than C99 provides */
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#define LISSP_MMAP
+#endif
+
+/* the JIT is only set up for 64-bit x86 unix */
+#if defined(__x86_64__) && !defined(_WIN32)
+#define LISSP_JIT
+#endif
+
+/* the reader scans with SSE2, and AVX2 where the CPU has it, on 64-bit x86 */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LISSP_SIMD
+#endif
+
 #include "mpc.h"
+#include <ctype.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef LISSP_SIMD
+#include <immintrin.h>
+#endif
 
 /* if we are compiling on windows compile these functions */
 #ifdef _WIN32
@@ -26,6 +49,17 @@ void add_history(char* unused) {}
 #include <editline/readline.h>
 #endif
 
+#ifdef LISSP_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#define LISSP_VERSION "0.0.0.1.0"
+
 mpc_parser_t* Number;
 mpc_parser_t* Symbol;
 mpc_parser_t* Comment;
@@ -38,11 +72,17 @@ mpc_parser_t* Lissp;
 
 struct lval;
 struct lenv;
+struct ljump;
+struct lcache;
+struct ljit;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct ljump ljump;
+typedef struct lcache lcache;
+typedef struct ljit ljit;
 
 /* create enumeration of possible lval types */
-typedef enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR } lval_type;
+typedef enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_RECUR } lval_type;
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
@@ -59,9 +99,13 @@ struct lval {
     lenv* env;
     lval* formals;
     lval* body;
+    ljit* jit; /* native code for the lambda, shared by copies */
 
     int count; /* expression related */
     lval** cell;
+    ljump* jump; /* case dispatch table shared by copies of a clause */
+    lcache* cache; /* global function called by this site, shared by copies */
+    int checked; /* epoch in which this call site was proven well typed */
 };
 
 /* construct pointer to new number lval */
@@ -106,6 +150,7 @@ lval* lval_builtin(lbuiltin func) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_FUN;
     v->builtin = func;
+    v->jit = NULL;
     return v;
 }
 
@@ -115,6 +160,9 @@ lval* lval_sexpr(void) {
     v->type = LVAL_SEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->jump = NULL;
+    v->cache = NULL;
+    v->checked = 0;
     return v;
 }
 
@@ -124,25 +172,129 @@ lval* lval_qexpr(void) {
     v->type = LVAL_QEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->jump = NULL;
+    v->cache = NULL;
+    v->checked = 0;
     return v;
 }
 
 struct lenv {
     lenv* par;
+    int version; /* changes whenever a binding does */
     int count;
     char** syms;
     lval** vals;
+    /* prelude 'fun' forms left unevaluated until their name is looked up */
+    int pending;
+    char** pending_syms;
+    lval** pending_funs;
 };
 
 lenv* lenv_new(void) {
     lenv* e = malloc(sizeof(lenv));
     e->par = NULL;
+    e->version = 0;
     e->count = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->pending = 0;
+    e->pending_syms = NULL;
+    e->pending_funs = NULL;
     return e;
 }
 
+/* how many environments currently bind each symbol name */
+typedef struct lsym {
+    char* name;
+    int binds;
+    int version; /* changes whenever a global binding of it is replaced */
+    struct lsym* next;
+} lsym;
+
+#define LSYM_BUCKETS 1024
+
+lsym* lsym_table[LSYM_BUCKETS];
+
+lsym* lsym_get(char* name) {
+    unsigned long h = 5381;
+    for (unsigned char* c = (unsigned char*)name; *c; c++) { h = h * 33 + *c; }
+    h = h % LSYM_BUCKETS;
+    
+    for (lsym* s = lsym_table[h]; s; s = s->next) {
+        if (strcmp(s->name, name) == 0) { return s; }
+    }
+    
+    lsym* s = malloc(sizeof(lsym));
+    s->name = malloc(strlen(name)+1);
+    strcpy(s->name, name);
+    s->binds = 0;
+    s->version = 0;
+    s->next = lsym_table[h];
+    lsym_table[h] = s;
+    return s;
+}
+
+/* a call site remembers which global function its head symbol named */
+struct lcache {
+    int refs;
+    lsym* sym;
+    lenv* env; /* NULL until filled */
+    int version; /* of "sym" when filled */
+    lval* val; /* borrowed from "env" */
+};
+
+unsigned long lcache_hits = 0;
+unsigned long lcache_misses = 0;
+
+/* number of cached calls whose function is in use while arguments are evaluated */
+int lcache_held = 0;
+
+void lcache_release(lval* v) {
+    if (!v->cache) { return; }
+    if (--v->cache->refs == 0) { free(v->cache); }
+    v->cache = NULL;
+}
+
+/* a global binding that native code was compiled against */
+typedef struct {
+    lval* key;
+    lsym* sym;
+    int kind; /* one of the LJIT_GUARD values */
+    lbuiltin func;
+    double num;
+} ljit_guard;
+
+enum { LJIT_GUARD_BUILTIN, LJIT_GUARD_SELF, LJIT_GUARD_NUM };
+
+int ljit_enabled = 0;
+
+struct ljit {
+    int refs;
+    int calls;
+    int state; /* 0 until compiled, 1 once compiled, -1 if it cannot be */
+    lenv* root;
+    int version; /* of "root" when the guards last held */
+    int guards_num;
+    ljit_guard* guards;
+    void* code;
+    int size;
+};
+
+void lval_del(lval* v);
+
+void ljit_release(lval* v) {
+    if (!v->jit) { return; }
+    if (--v->jit->refs == 0) {
+        for (int i = 0; i < v->jit->guards_num; i++) { lval_del(v->jit->guards[i].key); }
+        free(v->jit->guards);
+        #ifdef LISSP_JIT
+        if (v->jit->code) { munmap(v->jit->code, v->jit->size); }
+        #endif
+        free(v->jit);
+    }
+    v->jit = NULL;
+}
+
 char* ltype_name(int t) {
     switch(t) {
         case LVAL_FUN: return "Function";
@@ -152,6 +304,7 @@ char* ltype_name(int t) {
         case LVAL_SYM: return "Symbol";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_RECUR: return "Recur";
         default: return "Unknown";
     }
 }
@@ -159,21 +312,58 @@ char* ltype_name(int t) {
 lval* lval_copy(lval* v);
 void lenv_del(lenv* e);
 
+/* hashed dispatch table for a 'case' call site, shared by all copies of it */
+typedef struct lcase {
+    int refs;
+    int count;  /* number of arguments the table was built for */
+    int dflt;   /* index of the 'otherwise' clause, or -1 */
+    int size;   /* number of slots, always a power of two */
+    int* slots; /* index of the clause for each slot, -1 if empty */
+} lcase;
+
+/* each clause knows its position so a reordered clause list is never trusted */
+struct ljump {
+    int refs;
+    int pos;
+    lcase* table;
+};
+
+void ljump_release(lval* v) {
+    if (!v->jump) { return; }
+    if (--v->jump->refs == 0) {
+        if (--v->jump->table->refs == 0) {
+            free(v->jump->table->slots);
+            free(v->jump->table);
+        }
+        free(v->jump);
+    }
+    v->jump = NULL;
+}
+
 lenv* lenv_copy(lenv* e) {
     lenv* n = malloc(sizeof(lenv));
     n->par = e->par;
+    n->version = 0;
     n->count = e->count;
     n->syms = malloc(sizeof(char*) * n->count);
     n->vals = malloc(sizeof(lval*) * n->count);
+    n->pending = 0;
+    n->pending_syms = NULL;
+    n->pending_funs = NULL;
     for (int i = 0; i < e->count; i++) {
         n->syms[i] = malloc(strlen(e->syms[i]) + 1);
         strcpy(n->syms[i], e->syms[i]);
         n->vals[i] = lval_copy(e->vals[i]);
+        lsym_get(n->syms[i])->binds++;
     }
     return n;
 }
 
 lval* lval_add(lval* v, lval* x) {
+    /* any change to a list invalidates its dispatch table, cache and checks */
+    ljump_release(v);
+    lcache_release(v);
+    v->checked = 0;
     v->count++;
     v->cell = realloc(v->cell, sizeof(lval*) * v->count);
     v->cell[v->count-1] = x;
@@ -188,6 +378,8 @@ lval* lval_copy(lval* v) {
     switch (v->type) {
         /* copy functions and numbers directly */
         case LVAL_FUN:
+            x->jit = v->jit;
+            if (x->jit) { x->jit->refs++; }
             if (v->builtin) {
                 x->builtin=v->builtin;
             } else {
@@ -207,11 +399,17 @@ lval* lval_copy(lval* v) {
         /* copy lists by copying each sub-expression */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
+        case LVAL_RECUR:
             x->count = v->count;
             x->cell = malloc(sizeof(lval*) * x->count);
             for (int i = 0; i < x->count; i++) {
                 x->cell[i] = lval_copy(v->cell[i]);
             }
+            x->jump = v->jump;
+            if (x->jump) { x->jump->refs++; }
+            x->cache = v->cache;
+            if (x->cache) { x->cache->refs++; }
+            x->checked = v->checked;
         break;
     }
 
@@ -232,15 +430,19 @@ void lval_del(lval* v) {
                 lval_del(v->formals);
                 lval_del(v->body);
             }
+            ljit_release(v);
 	break;
         /* if qexpr or sexpr then delete all elements inside */
         case LVAL_SEXPR:
 	case LVAL_QEXPR:
+	case LVAL_RECUR:
             for (int i = 0; i < v->count; i++) {
                 lval_del(v->cell[i]);
             }
             /* also free memory allocated to contain the pointers */
             free(v->cell);
+            ljump_release(v);
+            lcache_release(v);
         break;
     }
     
@@ -265,6 +467,8 @@ lval* lval_read_str(mpc_ast_t* t) {
     return str;
 }
 
+void lval_read_site(lval* x);
+
 lval* lval_read(mpc_ast_t* t) {
 
     /* if symbol or number return conversion to that type */
@@ -288,6 +492,371 @@ lval* lval_read(mpc_ast_t* t) {
         if (strstr(t->children[i]->tag,    "comment")) { continue; }
 	x = lval_add(x, lval_read(t->children[i]));
     }	
+    lval_read_site(x);
+    return x;
+}
+
+/* a reader that builds lvals straight from text, accepting exactly what */
+/* the grammar given to mpc in main does, which is kept as --mpc-reader */
+int lreader_mpc = 0;
+
+/* with --packrat, mpc remembers how grammar rules ended, within 64MB */
+int lreader_packrat = 0;
+mpc_memo_t lreader_memo = {64 << 20, 0, 0, 0, 0, 0, NULL, NULL};
+
+/* every mpc parse shares one context, kept for the life of the process */
+mpc_context_t* lreader_context = NULL;
+
+int lreader_mpc_parse(const char* name, const char* s, size_t len, mpc_result_t* r) {
+    if (!lreader_context) {
+        lreader_context = mpc_context_new();
+        if (lreader_packrat) {
+            mpc_memo_ast(&lreader_memo);
+            mpc_context_memo(lreader_context, &lreader_memo);
+        }
+    }
+    return mpc_nparse_context(lreader_context, name, s, len, Lissp, r);
+}
+
+typedef struct {
+    const char* text;
+    const char* s;
+    const char* end;
+    const char* name;
+    lval* err;
+} lreader;
+
+#define LREAD_SPACE  1
+#define LREAD_DIGIT  2
+#define LREAD_SYMBOL 4
+
+unsigned char lreader_class[256];
+
+#define LREAD_IS(r, p, k) ((p) < (r)->end && (lreader_class[(unsigned char)*(p)] & (k)))
+
+/* each scan returns the first byte in [s, end) that ends a run */
+typedef const char* (*lscan_fn)(const char* s, const char* end);
+
+typedef struct {
+    char* name;
+    lscan_fn digits; /* of digits */
+    lscan_fn symbol; /* of symbol characters */
+    lscan_fn string; /* of string contents, up to a quote or backslash */
+    lscan_fn line;   /* of a comment, up to the end of its line */
+} lscan;
+
+const char* lscan_digits(const char* s, const char* end) {
+    while (s < end && (lreader_class[(unsigned char)*s] & LREAD_DIGIT)) { s++; }
+    return s;
+}
+
+const char* lscan_symbol(const char* s, const char* end) {
+    while (s < end && (lreader_class[(unsigned char)*s] & LREAD_SYMBOL)) { s++; }
+    return s;
+}
+
+const char* lscan_string(const char* s, const char* end) {
+    while (s < end && *s != '"' && *s != '\\') { s++; }
+    return s;
+}
+
+const char* lscan_line(const char* s, const char* end) {
+    while (s < end && *s != '\n' && *s != '\r') { s++; }
+    return s;
+}
+
+#ifdef LISSP_SIMD
+
+/* the same scans over whole blocks, finishing any tail a byte at a time */
+/* classes are built from signed compares, which no byte above 0x7F passes */
+
+static inline __m128i lscan_range16(__m128i x, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo-1)), _mm_cmplt_epi8(x, _mm_set1_epi8(hi+1)));
+}
+
+static inline __m128i lscan_symbol16(__m128i x) {
+    __m128i m = _mm_or_si128(lscan_range16(x, 'a', 'z'), lscan_range16(x, 'A', 'Z'));
+    m = _mm_or_si128(m, lscan_range16(x, '0', '9'));
+    m = _mm_or_si128(m, lscan_range16(x, '*', '+'));
+    m = _mm_or_si128(m, lscan_range16(x, '<', '>'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('-')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('/')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('!')));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('&')));
+}
+
+static inline __m128i lscan_either16(__m128i x, char a, char b) {
+    return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(a)), _mm_cmpeq_epi8(x, _mm_set1_epi8(b)));
+}
+
+const char* lscan_digits_sse2(const char* s, const char* end) {
+    for (; end - s >= 16; s += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)s);
+        unsigned m = ~_mm_movemask_epi8(lscan_range16(x, '0', '9')) & 0xFFFF;
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_digits(s, end);
+}
+
+const char* lscan_symbol_sse2(const char* s, const char* end) {
+    for (; end - s >= 16; s += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)s);
+        unsigned m = ~_mm_movemask_epi8(lscan_symbol16(x)) & 0xFFFF;
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_symbol(s, end);
+}
+
+const char* lscan_string_sse2(const char* s, const char* end) {
+    for (; end - s >= 16; s += 16) {
+        unsigned m = _mm_movemask_epi8(lscan_either16(_mm_loadu_si128((const __m128i*)s), '"', '\\'));
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_string(s, end);
+}
+
+const char* lscan_line_sse2(const char* s, const char* end) {
+    for (; end - s >= 16; s += 16) {
+        unsigned m = _mm_movemask_epi8(lscan_either16(_mm_loadu_si128((const __m128i*)s), '\n', '\r'));
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_line(s, end);
+}
+
+#define LSCAN_AVX2 __attribute__((target("avx2")))
+
+static inline LSCAN_AVX2 __m256i lscan_range32(__m256i x, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(lo-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi+1), x));
+}
+
+static inline LSCAN_AVX2 __m256i lscan_symbol32(__m256i x) {
+    __m256i m = _mm256_or_si256(lscan_range32(x, 'a', 'z'), lscan_range32(x, 'A', 'Z'));
+    m = _mm256_or_si256(m, lscan_range32(x, '0', '9'));
+    m = _mm256_or_si256(m, lscan_range32(x, '*', '+'));
+    m = _mm256_or_si256(m, lscan_range32(x, '<', '>'));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('!')));
+    return _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('&')));
+}
+
+static inline LSCAN_AVX2 __m256i lscan_either32(__m256i x, char a, char b) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(a)), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(b)));
+}
+
+LSCAN_AVX2 const char* lscan_digits_avx2(const char* s, const char* end) {
+    for (; end - s >= 32; s += 32) {
+        unsigned m = ~(unsigned)_mm256_movemask_epi8(lscan_range32(_mm256_loadu_si256((const __m256i*)s), '0', '9'));
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_digits_sse2(s, end);
+}
+
+LSCAN_AVX2 const char* lscan_symbol_avx2(const char* s, const char* end) {
+    for (; end - s >= 32; s += 32) {
+        unsigned m = ~(unsigned)_mm256_movemask_epi8(lscan_symbol32(_mm256_loadu_si256((const __m256i*)s)));
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_symbol_sse2(s, end);
+}
+
+LSCAN_AVX2 const char* lscan_string_avx2(const char* s, const char* end) {
+    for (; end - s >= 32; s += 32) {
+        unsigned m = _mm256_movemask_epi8(lscan_either32(_mm256_loadu_si256((const __m256i*)s), '"', '\\'));
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_string_sse2(s, end);
+}
+
+LSCAN_AVX2 const char* lscan_line_avx2(const char* s, const char* end) {
+    for (; end - s >= 32; s += 32) {
+        unsigned m = _mm256_movemask_epi8(lscan_either32(_mm256_loadu_si256((const __m256i*)s), '\n', '\r'));
+        if (m) { return s + __builtin_ctz(m); }
+    }
+    return lscan_line_sse2(s, end);
+}
+
+#endif
+
+/* from plainest to fastest, the last one the CPU supports being used */
+lscan lscan_levels[] = {
+    {"scalar", lscan_digits, lscan_symbol, lscan_string, lscan_line},
+    #ifdef LISSP_SIMD
+    {"sse2", lscan_digits_sse2, lscan_symbol_sse2, lscan_string_sse2, lscan_line_sse2},
+    {"avx2", lscan_digits_avx2, lscan_symbol_avx2, lscan_string_avx2, lscan_line_avx2},
+    #endif
+};
+
+int lscan_count = 1;
+lscan lreader_scan;
+
+void lreader_init(void) {
+    for (const char* c = " \f\n\r\t\v"; *c; c++) { lreader_class[(unsigned char)*c] = LREAD_SPACE; }
+    for (int c = 'a'; c <= 'z'; c++) { lreader_class[c] = LREAD_SYMBOL; }
+    for (int c = 'A'; c <= 'Z'; c++) { lreader_class[c] = LREAD_SYMBOL; }
+    for (int c = '0'; c <= '9'; c++) { lreader_class[c] = LREAD_SYMBOL | LREAD_DIGIT; }
+    for (const char* c = "_+-*/\\=<>!&"; *c; c++) { lreader_class[(unsigned char)*c] = LREAD_SYMBOL; }
+    
+    #ifdef LISSP_SIMD
+    lscan_count = __builtin_cpu_supports("avx2") ? 3 : 2;
+    #endif
+    lreader_scan = lscan_levels[lscan_count-1];
+}
+
+/* fail at the current position, reporting it as mpc does */
+lval* lreader_error(lreader* r, char* expected) {
+    int row = 0, col = 0;
+    for (const char* c = r->text; c < r->s; c++) {
+        if (*c == '\n') { row++; col = 0; } else { col++; }
+    }
+    char got[16];
+    if (r->s >= r->end) { strcpy(got, "end of input"); }
+    else if (*r->s == '\n') { strcpy(got, "newline"); }
+    else if (isprint((unsigned char)*r->s)) { sprintf(got, "'%c'", *r->s); }
+    else { sprintf(got, "byte 0x%02x", (unsigned char)*r->s); }
+    r->err = lval_err("%s:%i:%i: error: expected %s at %s\n", r->name, row+1, col+1, expected, got);
+    return NULL;
+}
+
+/* whitespace and comments between expressions */
+void lreader_space(lreader* r) {
+    while (r->s < r->end) {
+        if (lreader_class[(unsigned char)*r->s] & LREAD_SPACE) { r->s++; continue; }
+        if (*r->s != ';') { return; }
+        r->s = lreader_scan.line(r->s, r->end);
+    }
+}
+
+lval* lreader_num(lreader* r) {
+    const char* s = r->s;
+    if (*s == '-') { s++; }
+    s = lreader_scan.digits(s, r->end);
+    if (s < r->end && *s == '.') { s = lreader_scan.digits(s+1, r->end); }
+    
+    /* converted just as lval_read_num does, from a terminated copy */
+    char small[64];
+    int n = s - r->s;
+    char* t = n < 64 ? small : malloc(n+1);
+    memcpy(t, r->s, n);
+    t[n] = '\0';
+    r->s = s;
+    
+    char* end;
+    errno = 0;
+    double x = strtod(t, &end);
+    lval* v = (*end || errno == EINVAL || errno == ERANGE) ? lval_err("Invalid number.") : lval_num(x);
+    if (t != small) { free(t); }
+    return v;
+}
+
+lval* lreader_sym(lreader* r) {
+    const char* s = lreader_scan.symbol(r->s, r->end);
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SYM;
+    v->sym = malloc(s - r->s + 1);
+    memcpy(v->sym, r->s, s - r->s);
+    v->sym[s - r->s] = '\0';
+    r->s = s;
+    return v;
+}
+
+/* escapes are those of mpcf_unescape, anything else is kept as written */
+lval* lreader_str(lreader* r) {
+    const char* s = lreader_scan.string(r->s + 1, r->end);
+    while (s < r->end && *s != '"') { s = lreader_scan.string(s + (s+1 < r->end ? 2 : 1), r->end); }
+    if (s >= r->end) { r->s = s; return lreader_error(r, "'\"'"); }
+    
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_STR;
+    v->str = malloc(s - r->s);
+    char* o = v->str;
+    for (const char* c = r->s + 1; c < s; c++) {
+        /* runs between escapes are copied whole */
+        const char* run = lreader_scan.string(c, s);
+        memcpy(o, c, run - c);
+        o += run - c;
+        c = run;
+        if (c == s) { break; }
+        switch (c[1]) {
+            case 'a': *o++ = '\a'; c++; break;
+            case 'b': *o++ = '\b'; c++; break;
+            case 'f': *o++ = '\f'; c++; break;
+            case 'n': *o++ = '\n'; c++; break;
+            case 'r': *o++ = '\r'; c++; break;
+            case 't': *o++ = '\t'; c++; break;
+            case 'v': *o++ = '\v'; c++; break;
+            case '\\': case '\'': case '"': *o++ = c[1]; c++; break;
+            case '0': c++; break;
+            default: *o++ = '\\';
+        }
+    }
+    *o = '\0';
+    r->s = s + 1;
+    return v;
+}
+
+lval* lreader_expr(lreader* r) {
+    const char* s = r->s;
+    
+    /* numbers are tried before symbols, as in the grammar */
+    if (LREAD_IS(r, s, LREAD_DIGIT) || (*s == '-' && LREAD_IS(r, s+1, LREAD_DIGIT))) {
+        return lreader_num(r);
+    }
+    if (LREAD_IS(r, s, LREAD_SYMBOL)) { return lreader_sym(r); }
+    if (*s == '"') { return lreader_str(r); }
+    if (*s != '(' && *s != '{') { return lreader_error(r, "expression"); }
+    
+    char close = *s == '(' ? ')' : '}';
+    lval* x = *s == '(' ? lval_sexpr() : lval_qexpr();
+    r->s++;
+    while (1) {
+        lreader_space(r);
+        if (r->s < r->end && *r->s == close) { r->s++; break; }
+        lval* y = r->s < r->end ? lreader_expr(r)
+            : lreader_error(r, close == ')' ? "')'" : "'}'");
+        if (!y) { lval_del(x); return NULL; }
+        x = lval_add(x, y);
+    }
+    lval_read_site(x);
+    return x;
+}
+
+/* the next top-level form, or NULL at the end or with "err" set on an error */
+lval* lreader_form(lreader* r) {
+    lreader_space(r);
+    return r->s < r->end ? lreader_expr(r) : NULL;
+}
+
+/* read a whole string, such as a line typed at the prompt, into one */
+/* S-Expression, or print why it cannot be read and return NULL */
+lval* lval_read_string(char* name, char* input) {
+    if (lreader_mpc) {
+        mpc_result_t r;
+        if (!lreader_mpc_parse(name, input, strlen(input), &r)) {
+            mpc_err_print(r.error);
+            mpc_err_delete(r.error);
+            return NULL;
+        }
+        lval* x = lval_read(r.output);
+        mpc_ast_delete(r.output);
+        return x;
+    }
+    
+    lreader r = {input, input, input + strlen(input), name, NULL};
+    lval* x = lval_sexpr();
+    lval* y;
+    while ((y = lreader_form(&r))) { x = lval_add(x, y); }
+    if (r.err) {
+        printf("%s", r.err->err);
+        lval_del(r.err);
+        lval_del(x);
+        return NULL;
+    }
+    lval_read_site(x);
     return x;
 }
 
@@ -332,12 +901,17 @@ void lval_print(lval* v) {
         break;
         case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
         case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+        case LVAL_RECUR: printf("<recur>"); break;
     }
 }
 
 void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 
 lval* lval_pop(lval* v, int i) {
+    ljump_release(v);
+    lcache_release(v);
+    v->checked = 0;
+    
     /* find the item at "i" */
     lval* x = v->cell[i];
     
@@ -374,6 +948,7 @@ lval* lval_lambda(lval* formals, lval* body) {
     v->type = LVAL_FUN;
     
     v->builtin = NULL;
+    v->jit = NULL;
     
     v->env = lenv_new();
     
@@ -384,14 +959,23 @@ lval* lval_lambda(lval* formals, lval* body) {
 
 void lenv_del(lenv* e) {
     for (int i = 0; i < e->count; i++) {
+        lsym_get(e->syms[i])->binds--;
         free(e->syms[i]);
         lval_del(e->vals[i]);
     }
+    for (int i = 0; i < e->pending; i++) {
+        free(e->pending_syms[i]);
+        lval_del(e->pending_funs[i]);
+    }
     free(e->syms);
     free(e->vals);
+    free(e->pending_syms);
+    free(e->pending_funs);
     free(e);
 }
 
+lval* lenv_force(lenv* e, lval* k);
+
 lval* lenv_get(lenv* e, lval* k) {
 
     /* iterate over all items in environment */
@@ -403,19 +987,75 @@ lval* lenv_get(lenv* e, lval* k) {
     if (e->par) {
         return lenv_get(e->par, k);
     } else {
-    return lval_err("Unbound symbol '%s'", k->sym);
+        lval* v = lenv_force(e, k);
+        if (v) { return lval_copy(v); }
+        return lval_err("Unbound symbol '%s'", k->sym);
+    }
+}
+
+/* call sites proven by the checker stay valid while the epoch is unchanged */
+int lcheck_enabled = 0;
+int lcheck_epoch = 1;
+
+/* builtin names the checker relies upon, and whether each was ever rebound */
+#define LCHECK_NAMES 128
+
+typedef struct {
+    char* name;
+    int rebound;
+} lcheck_name;
+
+lcheck_name lcheck_names[LCHECK_NAMES];
+
+unsigned long lcheck_hash(char* s) {
+    unsigned long h = 14695981039346656037UL;
+    for (unsigned char* c = (unsigned char*)s; *c; c++) { h = (h ^ *c) * 1099511628211UL; }
+    return h;
+}
+
+lcheck_name* lcheck_find(char* name) {
+    unsigned long h = lcheck_hash(name) % LCHECK_NAMES;
+    while (lcheck_names[h].name) {
+        if (strcmp(lcheck_names[h].name, name) == 0) { return &lcheck_names[h]; }
+        h = (h+1) % LCHECK_NAMES;
     }
+    return NULL;
+}
+
+void lcheck_protect(char* name) {
+    unsigned long h = lcheck_hash(name) % LCHECK_NAMES;
+    while (lcheck_names[h].name) { h = (h+1) % LCHECK_NAMES; }
+    lcheck_names[h].name = name;
 }
 
+void lenv_undefer(lenv* e, char* sym);
+void lcache_bury(lval* v);
+
 void lenv_put(lenv* e, lval* k, lval* v) {
 
+    /* once a builtin name is rebound anywhere, with dynamic scope */
+    /* no call site using it can be trusted again */
+    if (lcheck_enabled) {
+        lcheck_name* n = lcheck_find(k->sym);
+        if (n) { n->rebound = 1; lcheck_epoch++; }
+    }
+
+    e->version++;
+    if (e->pending) { lenv_undefer(e, k->sym); }
+
     /* iterate over all items in evironment */
     /* to see if variable already exists */
     for (int i = 0; i < e->count; i++) {
         /* if variable is found, delete item at that position */
         /* and replace with variable supplied by user */
         if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
+            if (!e->par) { lsym_get(k->sym)->version++; }
+            /* a cached call may already have resolved its head to the old function */
+            if (lcache_held && !e->par && e->vals[i]->type == LVAL_FUN) {
+                lcache_bury(e->vals[i]);
+            } else {
+                lval_del(e->vals[i]);
+            }
             e->vals[i] = lval_copy(v);
             return;
         }
@@ -430,6 +1070,7 @@ void lenv_put(lenv* e, lval* k, lval* v) {
     e->vals[e->count-1] = lval_copy(v);
     e->syms[e->count-1] = malloc(strlen(k->sym)+1);
     strcpy(e->syms[e->count-1], k->sym);
+    lsym_get(k->sym)->binds++;
 }
 
 void lenv_def(lenv* e, lval* k, lval* v) {
@@ -439,19 +1080,83 @@ void lenv_def(lenv* e, lval* k, lval* v) {
     lenv_put(e, k, v);
 }
 
+/* keep the form "(fun {name args} {body})" to evaluate on first use of name */
+void lenv_defer(lenv* e, lval* x) {
+    char* sym = x->cell[1]->cell[0]->sym;
+    e->pending++;
+    e->pending_syms = realloc(e->pending_syms, sizeof(char*) * e->pending);
+    e->pending_funs = realloc(e->pending_funs, sizeof(lval*) * e->pending);
+    e->pending_syms[e->pending-1] = malloc(strlen(sym)+1);
+    strcpy(e->pending_syms[e->pending-1], sym);
+    e->pending_funs[e->pending-1] = x;
+}
+
+/* remove the pending form for "sym", returning it if there was one */
+lval* lenv_take_pending(lenv* e, char* sym) {
+    for (int i = 0; i < e->pending; i++) {
+        if (strcmp(e->pending_syms[i], sym) == 0) {
+            lval* x = e->pending_funs[i];
+            free(e->pending_syms[i]);
+            e->pending--;
+            e->pending_syms[i] = e->pending_syms[e->pending];
+            e->pending_funs[i] = e->pending_funs[e->pending];
+            return x;
+        }
+    }
+    return NULL;
+}
+
+/* a new binding replaces a pending definition without evaluating it */
+void lenv_undefer(lenv* e, char* sym) {
+    lval* x = lenv_take_pending(e, sym);
+    if (x) { lval_del(x); }
+}
+
+void ljit_attach(lval* f);
+
+/* evaluate the pending definition of "k", returning the value now bound */
+lval* lenv_force(lenv* e, lval* k) {
+    lval* x = e->pending ? lenv_take_pending(e, k->sym) : NULL;
+    if (!x) { return NULL; }
+    
+    /* exactly what the prelude's 'fun' would have bound */
+    lval_del(lval_pop(x->cell[1], 0));
+    lval* formals = lval_pop(x, 1);
+    lval* body = lval_pop(x, 1);
+    lval_del(x);
+    
+    lval* f = lval_lambda(formals, body);
+    ljit_attach(f);
+    lenv_put(e, k, f);
+    lval_del(f);
+    return e->vals[e->count-1];
+}
+
+/* evaluate every pending definition, before the environment is walked */
+void lenv_force_all(lenv* e) {
+    while (e->pending) {
+        lval* k = lval_sym(e->pending_syms[0]);
+        lenv_force(e, k);
+        lval_del(k);
+    }
+}
+
 #define MAX(x, y) (x>y) ? x : y;
 #define MIN(x, y) (x<y) ? x : y;
 
 #define LASSERT(args, cond, fmt, ...) \
     if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
     
+/* arguments of a call site proven by the checker need no further tests */
+#define LCHECKED(args) (args->checked == lcheck_epoch)
+
 #define LASSERT_TYPE(func, args, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(args, LCHECKED(args) || args->cell[index]->type == expect, \
         "Function '%s' passed incorrect type for argument %i. Got %s, expected %s.", \
         func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
-    LASSERT(args, args->count == num, \
+    LASSERT(args, LCHECKED(args) || args->count == num, \
         "Function '%s' passed incorrect number of arguments. Got %i, expected %i.", \
         func, args->count, num)
 
@@ -518,6 +1223,7 @@ lval* builtin_max(lenv* e, lval* a) { return builtin_op(e, a, "max"); }
 lval* builtin_min(lenv* e, lval* a) { return builtin_op(e, a, "min"); }
 
 lval* lval_eval(lenv* e, lval* v);
+lval* lval_eval_keep(lenv* e, lval* v);
 
 lval* builtin_head(lenv* e, lval* a) {
     /* check error conditions */
@@ -571,6 +1277,8 @@ lval* builtin_join(lenv* e, lval* a) {
     return x;
 }
 
+lval* lcheck_def(lenv* e, lval* k, lval* f);
+
 lval* builtin_var(lenv* e, lval* a, char* func) {
     LASSERT_TYPE(func, a, 0, LVAL_QEXPR)
     
@@ -592,6 +1300,14 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
         "Got %i, Expected %i.",
         func, syms->count, a->count-1);
     
+    /* report definite errors in new global functions before binding them */
+    if (lcheck_enabled && strcmp(func, "def") == 0) {
+        for (int i = 0; i < syms->count; i++) {
+            lval* err = lcheck_def(e, syms->cell[i], a->cell[i+1]);
+            if (err) { lval_del(a); return err; }
+        }
+    }
+    
     for (int i = 0; i < syms->count; i++) {
         /* if 'def' define globally, if 'put' define locally */
         if (strcmp(func, "def") == 0) {
@@ -669,6 +1385,7 @@ int lval_eq(lval* x, lval* y) {
         
         case LVAL_QEXPR:
         case LVAL_SEXPR:
+        case LVAL_RECUR:
             if (x->count != y->count) { return 0; }
             for (int i = 0; i < x->count; i++) {
                 /* list not equal if any element not equal */
@@ -721,241 +1438,3183 @@ lval* builtin_if(lenv* e, lval* a) {
     return x;
 }
 
-lval* builtin_lambda(lenv* e, lval* a) {
-    /* Check two arguments, each of which are Q-Expressions */
-    LASSERT_NUM("\\", a, 2);
-    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+/* evaluate whatever follows the test of a clause */
+lval* lval_eval_clause(lenv* e, lval* c) {
+    /* a lone Q-Expression is a block, just like the branches of 'if' */
+    if (c->count == 1 && c->cell[0]->type == LVAL_QEXPR) {
+        c = lval_take(c, 0);
+    }
+    c->type = LVAL_SEXPR;
+    return lval_eval(e, c);
+}
+
+lval* builtin_clauses(lenv* e, lval* a, char* func) {
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE(func, a, i, LVAL_QEXPR);
+        LASSERT_NOT_EMPTY(func, a, i);
+    }
     
-    for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-            "Cannot define non-symbol. Got %s, Expected %s.",
-            ltype_name(a->cell[0]->cell[i]->type),ltype_name(LVAL_SYM));
+    /* evaluate each test in order until one holds */
+    for (int i = 0; i < a->count; i++) {
+        lval* test = lval_eval(e, lval_pop(a->cell[i], 0));
+        if (test->type == LVAL_ERR) { lval_del(a); return test; }
+        if (test->type != LVAL_NUM) {
+            lval* err = lval_err(
+                "Function '%s' passed incorrect type for test %i. Got %s, expected %s.",
+                func, i, ltype_name(test->type), ltype_name(LVAL_NUM));
+            lval_del(test); lval_del(a);
+            return err;
+        }
+        
+        int hit = test->num ? 1 : 0;
+        lval_del(test);
+        if (hit) { return lval_eval_clause(e, lval_take(a, i)); }
     }
-    /* pop first to arguments and pass to lval_lambda */
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
-    lval_del(a);
     
-    return lval_lambda(formals, body);
+    lval_del(a);
+    return lval_err("No selection found");
 }
 
-lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
+lval* builtin_select(lenv* e, lval* a) {
+    return builtin_clauses(e, a, "select");
 }
 
-lval* builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
+lval* builtin_cond(lenv* e, lval* a) {
+    return builtin_clauses(e, a, "cond");
 }
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
-    lval* k = lval_sym(name);
-    lval* v = lval_builtin(func);
-    lenv_put(e, k, v);
-    lval_del(k); lval_del(v);
+int lval_is_otherwise(lval* k) {
+    return k->type == LVAL_SYM && strcmp(k->sym, "otherwise") == 0;
 }
 
-lval* builtin_print(lenv* e, lval* a) {
-    
-    for (int i = 0; i < a->count; i++) {
-        lval_print(a->cell[i]); putchar(' ');
+unsigned long lval_hash(lval* v) {
+    unsigned long h = 14695981039346656037UL;
+    if (v->type == LVAL_STR) {
+        for (unsigned char* c = (unsigned char*)v->str; *c; c++) {
+            h = (h ^ *c) * 1099511628211UL;
+        }
+        return h;
     }
     
-    putchar('\n');
-    lval_del(a);
-    
-    return lval_sexpr();
+    /* -0 and 0 are equal so they must hash the same */
+    double d = v->num == 0 ? 0 : v->num;
+    unsigned char bytes[sizeof(double)];
+    memcpy(bytes, &d, sizeof(double));
+    for (int i = 0; i < sizeof(double); i++) {
+        h = (h ^ bytes[i]) * 1099511628211UL;
+    }
+    return h;
 }
 
-lval* builtin_error(lenv* e, lval* a) {
-    LASSERT_NUM("error", a, 1);
-    LASSERT_TYPE("error", a, 0, LVAL_STR);
+/* build a jump table for a 'case' call site whose clauses start at "first" */
+/* if every key before 'otherwise' is a literal number or string */
+void lcase_build(lval* v, int first) {
+    int dflt = -1;
+    int keys = 0;
+    for (int i = first; i < v->count; i++) {
+        if (v->cell[i]->type != LVAL_QEXPR || v->cell[i]->count == 0) { return; }
+        lval* k = v->cell[i]->cell[0];
+        if (dflt != -1) { continue; }
+        if (lval_is_otherwise(k)) { dflt = i; continue; }
+        if (k->type == LVAL_STR) { keys++; continue; }
+        if (k->type == LVAL_NUM && k->num == k->num) { keys++; continue; }
+        return;
+    }
     
-    lval* err = lval_err(a->cell[0]->str);
+    /* positions are recorded as they will be seen by 'case' */
+    int shift = 1 - first;
     
-    lval_del(a);
-    return err;
-}
-
-lval* builtin_load(lenv* e, lval* a) {
-    LASSERT_NUM("load", a, 1);
-    LASSERT_TYPE("load", a, 0, LVAL_STR);
+    lcase* t = malloc(sizeof(lcase));
+    t->refs = 0;
+    t->count = v->count + shift;
+    t->dflt = dflt == -1 ? -1 : dflt + shift;
+    t->size = 8;
+    while (t->size < keys * 2) { t->size *= 2; }
+    t->slots = malloc(sizeof(int) * t->size);
+    for (int i = 0; i < t->size; i++) { t->slots[i] = -1; }
     
-    /* parse file given string name */
-    mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Lissp, &r)) {
-        
-        /* read contents */
-        lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+    for (int i = first; i < v->count && i != dflt; i++) {
+        lval* k = v->cell[i]->cell[0];
+        unsigned long h = lval_hash(k) & (t->size-1);
         
-        /* evaluate each expression */
-        while  (expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
+        /* earlier clauses win, so later duplicates are never reachable */
+        while (t->slots[h] != -1 && !lval_eq(v->cell[t->slots[h] - shift]->cell[0], k)) {
+            h = (h+1) & (t->size-1);
         }
+        if (t->slots[h] == -1) { t->slots[h] = i + shift; }
+    }
+    
+    for (int i = first; i < v->count; i++) {
+        ljump_release(v->cell[i]);
+        v->cell[i]->jump = malloc(sizeof(ljump));
+        v->cell[i]->jump->refs = 1;
+        v->cell[i]->jump->pos = i + shift;
+        v->cell[i]->jump->table = t;
+        t->refs++;
+    }
+}
+
+/* prepare a freshly read list, so any call site it holds is ready for use */
+void lval_read_site(lval* x) {
+    /* sites that call a named function get an inline cache */
+    if (x->count >= 2 && x->cell[0]->type == LVAL_SYM) {
+        x->cache = malloc(sizeof(lcache));
+        x->cache->refs = 1;
+        x->cache->sym = lsym_get(x->cell[0]->sym);
+        x->cache->env = NULL;
+    }
+    
+    if (x->count >= 3 && x->cell[0]->type == LVAL_SYM
+        && strcmp(x->cell[0]->sym, "case") == 0) {
+        lcase_build(x, 2);
+    }
+}
+
+/* matching clause from the jump table, 0 for none, -1 if there is no table */
+int lcase_lookup(lval* a) {
+    if (a->count < 2 || !a->cell[1]->jump) { return -1; }
+    
+    /* only trust the table if every clause is the one it was built from */
+    lcase* t = a->cell[1]->jump->table;
+    if (t->count != a->count) { return -1; }
+    for (int i = 1; i < a->count; i++) {
+        ljump* j = a->cell[i]->jump;
+        if (!j || j->table != t || j->pos != i) { return -1; }
+    }
+    
+    lval* x = a->cell[0];
+    if (x->type == LVAL_NUM || x->type == LVAL_STR) {
+        unsigned long h = lval_hash(x) & (t->size-1);
+        while (t->slots[h] != -1) {
+            if (lval_eq(a->cell[t->slots[h]]->cell[0], x)) { return t->slots[h]; }
+            h = (h+1) & (t->size-1);
+        }
+    }
+    
+    return t->dflt == -1 ? 0 : t->dflt;
+}
+
+lval* builtin_case(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 1,
+        "Function 'case' passed incorrect number of arguments. Got %i, expected at least %i.",
+        a->count, 1);
+    for (int i = 1; i < a->count; i++) {
+        LASSERT_TYPE("case", a, i, LVAL_QEXPR);
+        LASSERT_NOT_EMPTY("case", a, i);
+    }
+    
+    int hit = lcase_lookup(a);
+    
+    /* keys that are not literals are evaluated in order */
+    for (int i = 1; hit == -1 && i < a->count; i++) {
+        lval* k = a->cell[i]->cell[0];
+        if (lval_is_otherwise(k)) { hit = i; break; }
+        
+        int eq;
+        if (k->type == LVAL_NUM || k->type == LVAL_STR || k->type == LVAL_QEXPR) {
+            eq = lval_eq(a->cell[0], k);
+        } else {
+            k = lval_eval(e, lval_copy(k));
+            if (k->type == LVAL_ERR) { lval_del(a); return k; }
+            eq = lval_eq(a->cell[0], k);
+            lval_del(k);
+        }
+        if (eq) { hit = i; }
+    }
+    
+    if (hit <= 0) {
+        lval_del(a);
+        return lval_err("No case found");
+    }
+    
+    lval* c = lval_take(a, hit);
+    lval_del(lval_pop(c, 0));
+    return lval_eval_clause(e, c);
+}
+
+/* look up "k" directly in "e" only, without searching parents */
+lval* lenv_local(lenv* e, lval* k) {
+    for (int i = 0; i < e->count; i++) {
+        if (strcmp(e->syms[i], k->sym) == 0) { return e->vals[i]; }
+    }
+    return NULL;
+}
+
+/* rebind a loop counter, reusing its number when it still holds one */
+void lenv_put_num(lenv* e, lval* k, double x) {
+    lval* v = lenv_local(e, k);
+    if (v && v->type == LVAL_NUM) { v->num = x; e->version++; return; }
+    
+    v = lval_num(x);
+    lenv_put(e, k, v);
+    lval_del(v);
+}
+
+/* a 'recur' ending the body of any other loop cannot reach its 'loop' */
+lval* lval_recur_tail(lval* x) {
+    if (x->type != LVAL_RECUR) { return x; }
+    lval_del(x);
+    return lval_err("Function 'recur' used outside of tail position of 'loop'.");
+}
+
+lval* builtin_while(lenv* e, lval* a) {
+    LASSERT_NUM("while", a, 2);
+    LASSERT_TYPE("while", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("while", a, 1, LVAL_QEXPR);
+    
+    /* both are run in place each time round, so they are never copied */
+    lval* cond = a->cell[0];
+    lval* body = a->cell[1];
+    cond->type = LVAL_SEXPR;
+    body->type = LVAL_SEXPR;
+    
+    while (1) {
+        lval* c = lval_eval_keep(e, cond);
+        if (c->type == LVAL_ERR) { lval_del(a); return c; }
+        if (c->type != LVAL_NUM) {
+            lval* err = lval_err(
+                "Function 'while' condition returned incorrect type. Got %s, expected %s.",
+                ltype_name(c->type), ltype_name(LVAL_NUM));
+            lval_del(c); lval_del(a);
+            return err;
+        }
+        int run = c->num ? 1 : 0;
+        lval_del(c);
+        if (!run) { break; }
+        
+        lval* x = lval_recur_tail(lval_eval_keep(e, body));
+        if (x->type == LVAL_ERR) { lval_del(a); return x; }
+        lval_del(x);
+    }
+    
+    lval_del(a);
+    return lval_sexpr();
+}
+
+lval* builtin_dotimes(lenv* e, lval* a) {
+    LASSERT_NUM("dotimes", a, 2);
+    LASSERT_TYPE("dotimes", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("dotimes", a, 1, LVAL_QEXPR);
+    LASSERT(a, a->cell[0]->count == 2 && a->cell[0]->cell[0]->type == LVAL_SYM,
+        "Function 'dotimes' expects a symbol and a count, as in {i 10}.");
+    
+    lval* sym = a->cell[0]->cell[0];
+    lval* n = lval_eval_keep(e, a->cell[0]->cell[1]);
+    if (n->type == LVAL_ERR) { lval_del(a); return n; }
+    if (n->type != LVAL_NUM) {
+        lval* err = lval_err(
+            "Function 'dotimes' passed incorrect type for count. Got %s, expected %s.",
+            ltype_name(n->type), ltype_name(LVAL_NUM));
+        lval_del(n); lval_del(a);
+        return err;
+    }
+    double count = n->num;
+    lval_del(n);
+    
+    /* the counter is bound like '=' would, so the body can update locals */
+    lval* body = a->cell[1];
+    body->type = LVAL_SEXPR;
+    
+    lval* result = lval_sexpr();
+    for (double i = 0; i < count; i++) {
+        lenv_put_num(e, sym, i);
+        lval* x = lval_recur_tail(lval_eval_keep(e, body));
+        if (x->type == LVAL_ERR) { lval_del(result); result = x; break; }
+        lval_del(x);
+    }
+    
+    lval_del(a);
+    return result;
+}
+
+lval* builtin_foreach(lenv* e, lval* a) {
+    LASSERT_NUM("for-each", a, 2);
+    LASSERT_TYPE("for-each", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("for-each", a, 1, LVAL_QEXPR);
+    LASSERT(a, a->cell[0]->count == 2 && a->cell[0]->cell[0]->type == LVAL_SYM,
+        "Function 'for-each' expects a symbol and a list, as in {x l}.");
+    
+    lval* sym = a->cell[0]->cell[0];
+    lval* l = lval_eval_keep(e, a->cell[0]->cell[1]);
+    if (l->type == LVAL_ERR) { lval_del(a); return l; }
+    if (l->type != LVAL_QEXPR) {
+        lval* err = lval_err(
+            "Function 'for-each' passed incorrect type for list. Got %s, expected %s.",
+            ltype_name(l->type), ltype_name(LVAL_QEXPR));
+        lval_del(l); lval_del(a);
+        return err;
+    }
+    
+    lval* body = a->cell[1];
+    body->type = LVAL_SEXPR;
+    
+    lval* result = lval_sexpr();
+    for (int i = 0; i < l->count; i++) {
+        lenv_put(e, sym, l->cell[i]);
+        lval* x = lval_recur_tail(lval_eval_keep(e, body));
+        if (x->type == LVAL_ERR) { lval_del(result); result = x; break; }
+        lval_del(x);
+    }
+    
+    lval_del(l);
+    lval_del(a);
+    return result;
+}
+
+/* number of loop bodies being evaluated, outside of which 'recur' is an error */
+int lloop_depth = 0;
+
+lval* builtin_loop(lenv* e, lval* a) {
+    LASSERT_NUM("loop", a, 2);
+    LASSERT_TYPE("loop", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("loop", a, 1, LVAL_QEXPR);
+    
+    lval* binds = a->cell[0];
+    LASSERT(a, binds->count % 2 == 0,
+        "Function 'loop' expects symbol and value pairs, as in {i 0 acc 1}.");
+    for (int i = 0; i < binds->count; i += 2) {
+        LASSERT(a, binds->cell[i]->type == LVAL_SYM,
+            "Function 'loop' cannot bind non-symbol. Got %s, Expected %s.",
+            ltype_name(binds->cell[i]->type), ltype_name(LVAL_SYM));
+    }
+    
+    /* initial values are evaluated in the enclosing environment */
+    lenv* f = lenv_new();
+    f->par = e;
+    for (int i = 0; i < binds->count; i += 2) {
+        lval* x = lval_eval_keep(e, binds->cell[i+1]);
+        if (x->type == LVAL_ERR) { lenv_del(f); lval_del(a); return x; }
+        lenv_put(f, binds->cell[i], x);
+        lval_del(x);
+    }
+    
+    lval* body = a->cell[1];
+    body->type = LVAL_SEXPR;
+    
+    lval* x;
+    lloop_depth++;
+    while (1) {
+        x = lval_eval_keep(f, body);
+        if (x->type != LVAL_RECUR) { break; }
+        
+        if (x->count != binds->count / 2) {
+            lval* err = lval_err(
+                "Function 'recur' passed incorrect number of arguments. Got %i, expected %i.",
+                x->count, binds->count / 2);
+            lval_del(x);
+            x = err;
+            break;
+        }
+        
+        /* rebind in place, so the frame is reused for every iteration */
+        for (int i = 0; i < x->count; i++) {
+            lenv_put(f, binds->cell[i*2], x->cell[i]);
+        }
+        lval_del(x);
+    }
+    lloop_depth--;
+    
+    lenv_del(f);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_recur(lenv* e, lval* a) {
+    LASSERT(a, lloop_depth > 0, "Function 'recur' used outside of 'loop'.");
+    a->type = LVAL_RECUR;
+    return a;
+}
+
+lval* builtin_do(lenv* e, lval* a) {
+    /* arguments are already evaluated in order, so keep only the last */
+    if (a->count == 0) { return a; }
+    return lval_take(a, a->count-1);
+}
+
+/* 'recur' is only meaningful as the value of a loop body, so the last */
+/* argument of 'do' is the one place it may be passed as an argument */
+lval* lval_recur_arg(lval* f, lval* a) {
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type != LVAL_RECUR) { continue; }
+        if (f->builtin == builtin_do && i == a->count-1) { continue; }
+        return lval_recur_tail(lval_take(a, i));
+    }
+    return NULL;
+}
+
+lval* builtin_let(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function 'let' passed incorrect number of arguments. Got %i, expected %i or %i.",
+        a->count, 1, 2);
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_TYPE("let", a, i, LVAL_QEXPR);
+    }
+    
+    lval* binds = a->count == 2 ? a->cell[0] : NULL;
+    if (binds) {
+        LASSERT(a, binds->count % 2 == 0,
+            "Function 'let' expects symbol and value pairs, as in {x 1 y 2}.");
+        for (int i = 0; i < binds->count; i += 2) {
+            LASSERT(a, binds->cell[i]->type == LVAL_SYM,
+                "Function 'let' cannot bind non-symbol. Got %s, Expected %s.",
+                ltype_name(binds->cell[i]->type), ltype_name(LVAL_SYM));
+        }
+    }
+    
+    /* a single frame holds every binding and anything the body defines with '=' */
+    lenv* f = lenv_new();
+    f->par = e;
+    
+    /* each value can see the bindings before it */
+    for (int i = 0; binds && i < binds->count; i += 2) {
+        lval* x = lval_eval_keep(f, binds->cell[i+1]);
+        if (x->type == LVAL_ERR) { lenv_del(f); lval_del(a); return x; }
+        lenv_put(f, binds->cell[i], x);
+        lval_del(x);
+    }
+    
+    lval* body = lval_pop(a, a->count-1);
+    body->type = LVAL_SEXPR;
+    lval* x = lval_eval(f, body);
+    
+    lenv_del(f);
+    lval_del(a);
+    return x;
+}
+
+#define LJIT_THRESHOLD 10
+
+int ljit_has_loop(lval* x) {
+    if (x->type == LVAL_SYM) { return strcmp(x->sym, "loop") == 0; }
+    if (x->type != LVAL_SEXPR && x->type != LVAL_QEXPR) { return 0; }
+    for (int i = 0; i < x->count; i++) {
+        if (ljit_has_loop(x->cell[i])) { return 1; }
+    }
+    return 0;
+}
+
+/* give a new lambda a call counter when the JIT is on */
+void ljit_attach(lval* f) {
+    if (!ljit_enabled) { return; }
+    f->jit = calloc(1, sizeof(ljit));
+    f->jit->refs = 1;
+    /* the time spent in a loop makes a lambda hot on its first call */
+    if (ljit_has_loop(f->body)) { f->jit->calls = LJIT_THRESHOLD; }
+}
+
+lval* builtin_lambda(lenv* e, lval* a) {
+    /* Check two arguments, each of which are Q-Expressions */
+    LASSERT_NUM("\\", a, 2);
+    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+    
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+            "Cannot define non-symbol. Got %s, Expected %s.",
+            ltype_name(a->cell[0]->cell[i]->type),ltype_name(LVAL_SYM));
+    }
+    /* pop first to arguments and pass to lval_lambda */
+    lval* formals = lval_pop(a, 0);
+    lval* body = lval_pop(a, 0);
+    lval_del(a);
+    
+    lval* f = lval_lambda(formals, body);
+    ljit_attach(f);
+    return f;
+}
+
+lval* builtin_def(lenv* e, lval* a) {
+    return builtin_var(e, a, "def");
+}
+
+lval* builtin_put(lenv* e, lval* a) {
+    return builtin_var(e, a, "=");
+}
+
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+    lval* k = lval_sym(name);
+    lval* v = lval_builtin(func);
+    lenv_put(e, k, v);
+    lval_del(k); lval_del(v);
+}
+
+lval* builtin_print(lenv* e, lval* a) {
+    
+    for (int i = 0; i < a->count; i++) {
+        lval_print(a->cell[i]); putchar(' ');
+    }
+    
+    putchar('\n');
+    lval_del(a);
+    
+    return lval_sexpr();
+}
+
+lval* builtin_error(lenv* e, lval* a) {
+    LASSERT_NUM("error", a, 1);
+    LASSERT_TYPE("error", a, 0, LVAL_STR);
+    
+    lval* err = lval_err(a->cell[0]->str);
+    
+    lval_del(a);
+    return err;
+}
+
+/* called with each top-level form of a file, which it then owns */
+typedef void (*lform_fn)(lenv* e, lval* x, void* data);
+lval* lenv_load_file(lenv* e, char* path, lform_fn fn, void* data);
+
+/* evaluate each form of a loaded file as soon as it is read */
+void lform_eval(lenv* e, lval* x, void* data) {
+    x = lval_eval(e, x);
+    if (x->type == LVAL_ERR) { lval_println(x); }
+    lval_del(x);
+}
+
+lval* builtin_load(lenv* e, lval* a) {
+    LASSERT_NUM("load", a, 1);
+    LASSERT_TYPE("load", a, 0, LVAL_STR);
+    
+    lval* x = lenv_load_file(e, a->cell[0]->str, lform_eval, NULL);
+    lval_del(a);
+    return x;
+}
+
+/* every builtin with its signature, as used by the checker */
+/* argument types are given per position, the last one repeating */
+/* 'n' number, 's' string, 'q' Q-Expression, '*' anything */
+/* results also use 'f' for function and 'x' for an empty S-Expression */
+typedef struct {
+    char* name;
+    lbuiltin func;
+    int min;
+    int max; /* -1 for no limit */
+    char* args;
+    char ret;
+} lbuiltin_info;
+
+lval* builtin_save_image(lenv* e, lval* a);
+
+lbuiltin_info lbuiltins[] = {
+    /* list functions */
+    {"list", builtin_list, 0, -1, "*", 'q'},
+    {"head", builtin_head, 1, 1, "q", 'q'}, {"tail", builtin_tail, 1, 1, "q", 'q'},
+    {"eval", builtin_eval, 1, 1, "q", '*'}, {"join", builtin_join, 1, -1, "q", 'q'},
+    
+    /* mathematical functions */
+    {"+", builtin_add, 1, -1, "n", 'n'}, {"-", builtin_sub, 1, -1, "n", 'n'},
+    {"*", builtin_mul, 1, -1, "n", 'n'}, {"/", builtin_div, 1, -1, "n", 'n'},
+    {"max", builtin_max, 1, -1, "n", 'n'}, {"min", builtin_max, 1, -1, "n", 'n'},
+    {"%", builtin_mod, 1, -1, "n", 'n'},
+    
+    /* variable functions */
+    {"\\", builtin_lambda, 2, 2, "q", 'f'},
+    {"def", builtin_def, 1, -1, "q*", 'x'},
+    {"=", builtin_put, 1, -1, "q*", 'x'},
+    {"let", builtin_let, 1, 2, "q", '*'},
+    
+    /* sequencing functions */
+    {"do", builtin_do, 0, -1, "*", '*'},
+    {"progn", builtin_do, 0, -1, "*", '*'},
+    
+    /* comparison functions */
+    {"if", builtin_if, 3, 3, "nqq", '*'},
+    {"==", builtin_eq, 2, 2, "*", 'n'},
+    {"!=", builtin_ne, 2, 2, "*", 'n'},
+    {">", builtin_gt, 2, 2, "n", 'n'},
+    {"<", builtin_lt, 2, 2, "n", 'n'},
+    {">=", builtin_ge, 2, 2, "n", 'n'},
+    {"<=", builtin_le, 2, 2, "n", 'n'},
+    
+    /* conditional functions */
+    {"select", builtin_select, 0, -1, "q", '*'},
+    {"cond", builtin_cond, 0, -1, "q", '*'},
+    {"case", builtin_case, 1, -1, "*q", '*'},
+    
+    /* iteration functions */
+    {"while", builtin_while, 2, 2, "q", 'x'},
+    {"dotimes", builtin_dotimes, 2, 2, "q", 'x'},
+    {"for-each", builtin_foreach, 2, 2, "q", 'x'},
+    {"loop", builtin_loop, 2, 2, "q", '*'},
+    {"recur", builtin_recur, 0, -1, "*", '*'},
+    
+    /* string functions */
+    {"load", builtin_load, 1, 1, "s", 'x'},
+    {"save-image", builtin_save_image, 1, 1, "s", 'x'},
+    {"error", builtin_error, 1, 1, "s", '*'},
+    {"print", builtin_print, 0, -1, "*", 'x'},
+    
+    {NULL, NULL, 0, 0, NULL, 0}
+};
+
+/* functions compiled from Lissp with --emit-c, which have a table of their own */
+#ifdef LISSP_AOT
+extern lbuiltin_info laot_builtins[];
+#else
+lbuiltin_info laot_builtins[] = {{NULL, NULL, 0, 0, NULL, 0}};
+#endif
+
+lbuiltin_info* lbuiltin_tables[] = {lbuiltins, laot_builtins};
+
+void lenv_add_builtins(lenv* e) {
+    for (lbuiltin_info* b = lbuiltins; b->name; b++) {
+        lenv_add_builtin(e, b->name, b->func);
+    }
+    if (lcheck_enabled) {
+        for (lbuiltin_info* b = lbuiltins; b->name; b++) { lcheck_protect(b->name); }
+    }
+}
+
+/* definition time checking of new global functions */
+typedef struct {
+    lenv* root;
+    lval* name; /* function being defined */
+    lval* func;
+    lval* locals; /* symbols bound anywhere inside it */
+} lcheck;
+
+int lcheck_binds(lval* x) {
+    char* binders[] = {"=", "def", "let", "loop", "dotimes", "for-each", "\\", NULL};
+    if (x->count < 2 || x->cell[0]->type != LVAL_SYM) { return 0; }
+    for (char** b = binders; *b; b++) {
+        if (strcmp(x->cell[0]->sym, *b) == 0) { return 1; }
+    }
+    return 0;
+}
+
+/* collect every symbol that some form inside "x" might bind */
+void lcheck_locals(lval* locals, lval* x) {
+    if (x->type != LVAL_SEXPR && x->type != LVAL_QEXPR) { return; }
+    if (lcheck_binds(x) && x->cell[1]->type == LVAL_QEXPR) {
+        lval* syms = x->cell[1];
+        for (int i = 0; i < syms->count; i++) {
+            if (syms->cell[i]->type == LVAL_SYM) { lval_add(locals, lval_copy(syms->cell[i])); }
+        }
+    }
+    for (int i = 0; i < x->count; i++) { lcheck_locals(locals, x->cell[i]); }
+}
+
+int lcheck_local(lcheck* c, lval* k) {
+    for (int i = 0; i < c->locals->count; i++) {
+        if (strcmp(c->locals->cell[i]->sym, k->sym) == 0) { return 1; }
+    }
+    return 0;
+}
+
+int lcheck_ltype(char t) {
+    switch (t) {
+        case 'n': return LVAL_NUM;
+        case 's': return LVAL_STR;
+        case 'q': return LVAL_QEXPR;
+        case 'f': return LVAL_FUN;
+        case 'x': return LVAL_SEXPR;
+    }
+    return -1;
+}
+
+lval* lcheck_site(lcheck* c, lval* x, char* type);
+
+/* "type" is set to the result type when it is known, and '*' otherwise */
+lval* lcheck_expr(lcheck* c, lval* x, char* type) {
+    switch (x->type) {
+        case LVAL_NUM: *type = 'n'; return NULL;
+        case LVAL_STR: *type = 's'; return NULL;
+        case LVAL_QEXPR: *type = 'q'; return NULL;
+        case LVAL_SEXPR: return lcheck_site(c, x, type);
+        default: *type = '*'; return NULL;
+    }
+}
+
+/* a Q-Expression that some builtin will evaluate as code */
+lval* lcheck_block(lcheck* c, lval* x) {
+    char type;
+    if (x->type != LVAL_QEXPR) { return NULL; }
+    return lcheck_site(c, x, &type);
+}
+
+/* the part of a clause following its test */
+lval* lcheck_clause(lcheck* c, lval* x) {
+    char type;
+    if (x->count == 2 && x->cell[1]->type == LVAL_QEXPR) { return lcheck_block(c, x->cell[1]); }
+    for (int i = 1; i < x->count; i++) {
+        lval* err = lcheck_expr(c, x->cell[i], &type);
+        if (err) { return err; }
+    }
+    return NULL;
+}
+
+/* walk the Q-Expressions a builtin runs as code */
+lval* lcheck_code(lcheck* c, char* name, lval* x) {
+    lval* err = NULL;
+    char type;
+    int n = x->count-1;
+    lval** args = x->cell+1;
+    
+    if (strcmp(name, "if") == 0) {
+        for (int i = 1; !err && i < n; i++) { err = lcheck_block(c, args[i]); }
+    } else if (strcmp(name, "eval") == 0 || strcmp(name, "while") == 0) {
+        for (int i = 0; !err && i < n; i++) { err = lcheck_block(c, args[i]); }
+    } else if (strcmp(name, "\\") == 0) {
+        if (n == 2) { err = lcheck_block(c, args[1]); }
+    } else if (strcmp(name, "dotimes") == 0 || strcmp(name, "for-each") == 0) {
+        if (n != 2) { return NULL; }
+        if (args[0]->type == LVAL_QEXPR && args[0]->count == 2) {
+            err = lcheck_expr(c, args[0]->cell[1], &type);
+        }
+        if (!err) { err = lcheck_block(c, args[1]); }
+    } else if (strcmp(name, "loop") == 0 || strcmp(name, "let") == 0) {
+        lval* binds = n == 2 ? args[0] : NULL;
+        if (binds && binds->type == LVAL_QEXPR) {
+            for (int i = 1; !err && i < binds->count; i += 2) {
+                err = lcheck_expr(c, binds->cell[i], &type);
+            }
+        }
+        if (!err && n >= 1) { err = lcheck_block(c, args[n-1]); }
+    } else if (strcmp(name, "select") == 0 || strcmp(name, "cond") == 0 || strcmp(name, "case") == 0) {
+        int first = strcmp(name, "case") == 0 ? 1 : 0;
+        for (int i = first; !err && i < n; i++) {
+            if (args[i]->type != LVAL_QEXPR || args[i]->count == 0) { continue; }
+            if (!first || args[i]->cell[0]->type == LVAL_SEXPR) {
+                err = lcheck_expr(c, args[i]->cell[0], &type);
+            }
+            if (!err) { err = lcheck_clause(c, args[i]); }
+        }
+    }
+    return err;
+}
+
+lval* lcheck_arity(lcheck* c, lval* k, int given, int min, int max) {
+    if (given >= min && (max == -1 || given <= max)) { return NULL; }
+    if (max == -1) {
+        return lval_err("Function '%s' calls '%s' with %i arguments, expected at least %i.",
+            c->name->sym, k->sym, given, min);
+    }
+    if (min == 0) {
+        return lval_err("Function '%s' calls '%s' with %i arguments, expected at most %i.",
+            c->name->sym, k->sym, given, max);
+    }
+    if (min == max) {
+        return lval_err("Function '%s' calls '%s' with %i arguments, expected %i.",
+            c->name->sym, k->sym, given, min);
+    }
+    return lval_err("Function '%s' calls '%s' with %i arguments, expected %i to %i.",
+        c->name->sym, k->sym, given, min, max);
+}
+
+lval* lcheck_site(lcheck* c, lval* x, char* type) {
+    *type = '*';
+    if (x->count == 0) { return NULL; }
+    if (x->count == 1) { return lcheck_expr(c, x->cell[0], type); }
+    
+    /* the type of every argument, as far as it is known */
+    int n = x->count-1;
+    char* types = malloc(n);
+    for (int i = 0; i < n; i++) {
+        lval* err = lcheck_expr(c, x->cell[i+1], &types[i]);
+        if (err) { free(types); return err; }
+    }
+    
+    lval* k = x->cell[0];
+    lval* f = NULL;
+    if (k->type == LVAL_SEXPR) {
+        char t;
+        lval* err = lcheck_site(c, k, &t);
+        if (err) { free(types); return err; }
+    }
+    if (k->type == LVAL_SYM && !lcheck_local(c, k)) {
+        f = strcmp(k->sym, c->name->sym) == 0 ? c->func : lenv_local(c->root, k);
+        if (!f) { f = lenv_force(c->root, k); }
+    }
+    if (!f || f->type != LVAL_FUN) { free(types); return NULL; }
+    
+    /* for global lambdas only the most arguments they can take is known */
+    if (!f->builtin) {
+        free(types);
+        lval* formals = f->formals;
+        for (int i = 0; i < formals->count; i++) {
+            if (strcmp(formals->cell[i]->sym, "&") == 0) { return NULL; }
+        }
+        return lcheck_arity(c, k, n, 0, formals->count);
+    }
+    
+    /* builtins whose names were ever rebound cannot be trusted */
+    lbuiltin_info* b = lbuiltins;
+    while (b->name && (strcmp(b->name, k->sym) != 0 || b->func != f->builtin)) { b++; }
+    lcheck_name* l = lcheck_find(k->sym);
+    if (!b->name || !l || l->rebound) { free(types); return NULL; }
+    
+    lval* err = lcheck_arity(c, k, n, b->min, b->max);
+    if (!err) { err = lcheck_code(c, b->name, x); }
+    
+    int known = 1;
+    int len = strlen(b->args);
+    for (int i = 0; !err && i < n; i++) {
+        char expect = b->args[i < len ? i : len-1];
+        if (expect == '*') { continue; }
+        if (types[i] == '*') { known = 0; continue; }
+        if (types[i] != expect) {
+            err = lval_err("Function '%s' passes %s to '%s' as argument %i, expected %s.",
+                c->name->sym, ltype_name(lcheck_ltype(types[i])), k->sym, i,
+                ltype_name(lcheck_ltype(expect)));
+        }
+    }
+    free(types);
+    if (err) { return err; }
+    
+    /* every argument is proven, so the builtin may skip its own checks */
+    if (known) { x->checked = lcheck_epoch; }
+    *type = b->ret;
+    return NULL;
+}
+
+lval* lcheck_def(lenv* e, lval* k, lval* f) {
+    if (f->type != LVAL_FUN || f->builtin) { return NULL; }
+    
+    lcheck c;
+    c.root = e;
+    while (c.root->par) { c.root = c.root->par; }
+    c.name = k;
+    c.func = f;
+    c.locals = lval_qexpr();
+    for (int i = 0; i < f->formals->count; i++) {
+        lval_add(c.locals, lval_copy(f->formals->cell[i]));
+    }
+    lcheck_locals(c.locals, f->body);
+    
+    lval* err = lcheck_block(&c, f->body);
+    lval_del(c.locals);
+    return err;
+}
+
+/* template JIT for lambdas that only do arithmetic on numbers */
+/* once a lambda has been called LJIT_THRESHOLD times its body is */
+/* translated a form at a time into x86-64 code working on doubles */
+
+unsigned long ljit_compiled = 0;
+unsigned long ljit_runs = 0;
+unsigned long ljit_bails = 0;
+
+/* entry point, returns non-zero if the interpreter must run the call instead */
+typedef int (*ljit_entry)(double* args, double* result);
+
+/* check the global bindings the code relies upon still hold */
+int ljit_guards(ljit* j) {
+    for (int i = 0; i < j->guards_num; i++) {
+        if (j->guards[i].sym->binds != 1) { return 0; }
+    }
+    if (j->root->version == j->version) { return 1; }
+    
+    for (int i = 0; i < j->guards_num; i++) {
+        ljit_guard* g = &j->guards[i];
+        lval* v = lenv_local(j->root, g->key);
+        if (!v) { return 0; }
+        switch (g->kind) {
+            case LJIT_GUARD_BUILTIN:
+                if (v->type != LVAL_FUN || v->builtin != g->func) { return 0; }
+            break;
+            case LJIT_GUARD_SELF:
+                if (v->type != LVAL_FUN || v->jit != j) { return 0; }
+            break;
+            case LJIT_GUARD_NUM:
+                if (v->type != LVAL_NUM || v->num != g->num) { return 0; }
+            break;
+        }
+    }
+    j->version = j->root->version;
+    return 1;
+}
+
+#ifdef LISSP_JIT
+
+#define LJIT_LOCALS 256
+
+/* target of 'recur' inside a 'loop' being compiled */
+typedef struct {
+    int head;
+    int first; /* slot of the first loop variable */
+    int count;
+} ljit_loop;
+
+typedef struct {
+    unsigned char* code;
+    int len;
+    int size;
+    
+    ljit* jit;
+    lenv* root;
+    int formals;
+    
+    /* names in scope and the stack slots holding them */
+    int locals_num;
+    char* locals[LJIT_LOCALS];
+    int slots[LJIT_LOCALS];
+    
+    /* stack slots in use, and the most ever used */
+    int depth;
+    int depth_max;
+    
+    int entry; /* offset of the function */
+    int body; /* offset of its body, target of self tail calls */
+    int bail; /* offset of code handing the call back to the interpreter */
+} ljit_ctx;
+
+void ljit_byte(ljit_ctx* c, int b) {
+    if (c->len == c->size) {
+        c->size = c->size ? c->size * 2 : 1024;
+        c->code = realloc(c->code, c->size);
+    }
+    c->code[c->len++] = b;
+}
+
+void ljit_bytes(ljit_ctx* c, char* b, int n) {
+    for (int i = 0; i < n; i++) { ljit_byte(c, (unsigned char)b[i]); }
+}
+
+void ljit_u32(ljit_ctx* c, unsigned int x) {
+    for (int i = 0; i < 4; i++) { ljit_byte(c, (x >> (8*i)) & 0xFF); }
+}
+
+/* rel32 operands are emitted as zero and patched once the target is known */
+int ljit_rel(ljit_ctx* c) {
+    int pos = c->len;
+    ljit_u32(c, 0);
+    return pos;
+}
+
+void ljit_patch(ljit_ctx* c, int pos, int target) {
+    unsigned int rel = (unsigned int)(target - (pos + 4));
+    for (int i = 0; i < 4; i++) { c->code[pos+i] = (rel >> (8*i)) & 0xFF; }
+}
+
+int ljit_jcc(ljit_ctx* c, int cc) {
+    ljit_byte(c, 0x0F); ljit_byte(c, cc);
+    return ljit_rel(c);
+}
+
+int ljit_jmp(ljit_ctx* c) {
+    ljit_byte(c, 0xE9);
+    return ljit_rel(c);
+}
+
+#define LJIT_JE 0x84
+#define LJIT_JP 0x8A
+
+/* slot "s" lives at [rbp - 8*(s+1)] */
+void ljit_slot_op(ljit_ctx* c, int prefix, int op, int reg, int s) {
+    ljit_byte(c, prefix); ljit_byte(c, 0x0F); ljit_byte(c, op);
+    ljit_byte(c, 0x80 | (reg << 3) | 5);
+    ljit_u32(c, (unsigned int)(-8 * (s+1)));
+}
+
+void ljit_load(ljit_ctx* c, int reg, int s) { ljit_slot_op(c, 0xF2, 0x10, reg, s); }
+void ljit_store(ljit_ctx* c, int s) { ljit_slot_op(c, 0xF2, 0x11, 0, s); }
+
+void ljit_const(ljit_ctx* c, int reg, double x) {
+    unsigned char bytes[8];
+    memcpy(bytes, &x, 8);
+    ljit_bytes(c, "\x48\xB8", 2); /* mov rax, imm64 */
+    for (int i = 0; i < 8; i++) { ljit_byte(c, bytes[i]); }
+    ljit_bytes(c, "\x66\x48\x0F\x6E", 4); /* movq xmm, rax */
+    ljit_byte(c, 0xC0 | (reg << 3));
+}
+
+/* register to register op with xmm0 as destination and xmm1 as source */
+void ljit_sse(ljit_ctx* c, int prefix, int op) {
+    ljit_byte(c, prefix); ljit_byte(c, 0x0F); ljit_byte(c, op); ljit_byte(c, 0xC1);
+}
+
+int ljit_slot(ljit_ctx* c) {
+    int s = c->depth++;
+    if (c->depth > c->depth_max) { c->depth_max = c->depth; }
+    return s;
+}
+
+int ljit_local(ljit_ctx* c, lval* k) {
+    for (int i = c->locals_num-1; i >= 0; i--) {
+        if (strcmp(c->locals[i], k->sym) == 0) { return c->slots[i]; }
+    }
+    return -1;
+}
+
+/* look up a global the code will rely upon, adding a guard for it */
+lval* ljit_global(ljit_ctx* c, lval* k) {
+    lsym* sym = lsym_get(k->sym);
+    if (sym->binds != 1) { return NULL; }
+    lval* v = lenv_local(c->root, k);
+    if (!v) { v = lenv_force(c->root, k); }
+    if (!v) { return NULL; }
+    
+    ljit* j = c->jit;
+    for (int i = 0; i < j->guards_num; i++) {
+        if (strcmp(j->guards[i].key->sym, k->sym) == 0) { return v; }
+    }
+    
+    ljit_guard g;
+    g.key = lval_sym(k->sym);
+    g.sym = sym;
+    g.func = NULL;
+    g.num = 0;
+    if (v->type == LVAL_NUM) {
+        g.kind = LJIT_GUARD_NUM;
+        g.num = v->num;
+    } else if (v->type == LVAL_FUN && v->builtin) {
+        g.kind = LJIT_GUARD_BUILTIN;
+        g.func = v->builtin;
+    } else if (v->type == LVAL_FUN && v->jit == j) {
+        g.kind = LJIT_GUARD_SELF;
+    } else {
+        lval_del(g.key);
+        return NULL;
+    }
+    j->guards = realloc(j->guards, sizeof(ljit_guard) * (j->guards_num+1));
+    j->guards[j->guards_num++] = g;
+    return v;
+}
+
+int ljit_expr(ljit_ctx* c, lval* x, int tail, ljit_loop* loop);
+
+/* load an operand straight into xmm1 if that needs no code of its own */
+int ljit_simple(ljit_ctx* c, lval* x) {
+    if (x->type == LVAL_NUM) { ljit_const(c, 1, x->num); return 1; }
+    if (x->type == LVAL_SYM && ljit_local(c, x) != -1) {
+        ljit_load(c, 1, ljit_local(c, x));
+        return 1;
+    }
+    return 0;
+}
+
+/* compile "a" into xmm0 and "b" into xmm1 */
+int ljit_pair(ljit_ctx* c, lval* a, lval* b) {
+    if (!ljit_expr(c, a, 0, NULL)) { return 0; }
+    if (ljit_simple(c, b)) { return 1; }
+    
+    int t = ljit_slot(c);
+    ljit_store(c, t);
+    if (!ljit_expr(c, b, 0, NULL)) { return 0; }
+    ljit_bytes(c, "\x66\x0F\x28\xC8", 4); /* movapd xmm1, xmm0 */
+    ljit_load(c, 0, t);
+    c->depth--;
+    return 1;
+}
+
+int ljit_arith(ljit_ctx* c, lval* x, int op) {
+    if (!ljit_expr(c, x->cell[1], 0, NULL)) { return 0; }
+    
+    /* a lone argument to '-' is negated */
+    if (x->count == 2 && op == 0x5C) {
+        ljit_const(c, 1, -0.0);
+        ljit_bytes(c, "\x66\x0F\x57\xC1", 4); /* xorpd xmm0, xmm1 */
+        return 1;
+    }
+    
+    for (int i = 2; i < x->count; i++) {
+        if (!ljit_simple(c, x->cell[i])) {
+            int t = ljit_slot(c);
+            ljit_store(c, t);
+            if (!ljit_expr(c, x->cell[i], 0, NULL)) { return 0; }
+            ljit_bytes(c, "\x66\x0F\x28\xC8", 4); /* movapd xmm1, xmm0 */
+            ljit_load(c, 0, t);
+            c->depth--;
+        }
+        
+        /* dividing by zero is an error the interpreter reports */
+        if (op == 0x5E) {
+            ljit_bytes(c, "\x66\x0F\x57\xD2", 4); /* xorpd xmm2, xmm2 */
+            ljit_bytes(c, "\x66\x0F\x2E\xCA", 4); /* ucomisd xmm1, xmm2 */
+            ljit_patch(c, ljit_jcc(c, LJIT_JE), c->bail);
+        }
+        ljit_sse(c, 0xF2, op);
+    }
+    return 1;
+}
+
+int ljit_compare(ljit_ctx* c, lval* x, int pred, int swap) {
+    if (x->count != 3) { return 0; }
+    if (!ljit_pair(c, x->cell[1], x->cell[2])) { return 0; }
+    
+    if (swap) {
+        ljit_bytes(c, "\xF2\x0F\xC2\xC8", 4); /* cmpsd xmm1, xmm0 */
+        ljit_byte(c, pred);
+        ljit_bytes(c, "\x66\x0F\x28\xC1", 4); /* movapd xmm0, xmm1 */
+    } else {
+        ljit_bytes(c, "\xF2\x0F\xC2\xC1", 4); /* cmpsd xmm0, xmm1 */
+        ljit_byte(c, pred);
+    }
+    
+    /* turn the all ones mask into 1 */
+    ljit_const(c, 1, 1.0);
+    ljit_sse(c, 0x66, 0x54); /* andpd */
+    return 1;
+}
+
+/* test xmm0, returning the jump to patch for when it is false */
+int ljit_test(ljit_ctx* c) {
+    ljit_bytes(c, "\x66\x0F\x57\xC9", 4); /* xorpd xmm1, xmm1 */
+    ljit_bytes(c, "\x66\x0F\x2E\xC1", 4); /* ucomisd xmm0, xmm1 */
+    
+    /* NaN is not zero, so it counts as true */
+    int nan = ljit_jcc(c, LJIT_JP);
+    int no = ljit_jcc(c, LJIT_JE);
+    ljit_patch(c, nan, c->len);
+    return no;
+}
+
+/* a Q-Expression evaluated as code */
+int ljit_block(ljit_ctx* c, lval* x, int tail, ljit_loop* loop) {
+    if (x->type != LVAL_QEXPR) { return 0; }
+    if (x->count == 1) { return ljit_expr(c, x->cell[0], tail, loop); }
+    return ljit_expr(c, x, tail, loop);
+}
+
+int ljit_if(ljit_ctx* c, lval* x, int tail, ljit_loop* loop) {
+    if (x->count != 4) { return 0; }
+    if (!ljit_expr(c, x->cell[1], 0, NULL)) { return 0; }
+    int no = ljit_test(c);
+    if (!ljit_block(c, x->cell[2], tail, loop)) { return 0; }
+    int end = ljit_jmp(c);
+    ljit_patch(c, no, c->len);
+    if (!ljit_block(c, x->cell[3], tail, loop)) { return 0; }
+    ljit_patch(c, end, c->len);
+    return 1;
+}
+
+int ljit_select(ljit_ctx* c, lval* x, int tail, ljit_loop* loop) {
+    int ends[LJIT_LOCALS];
+    int ends_num = 0;
+    
+    for (int i = 1; i < x->count; i++) {
+        lval* clause = x->cell[i];
+        if (clause->type != LVAL_QEXPR || clause->count != 2) { return 0; }
+        if (ends_num == LJIT_LOCALS) { return 0; }
+        
+        if (!ljit_expr(c, clause->cell[0], 0, NULL)) { return 0; }
+        int no = ljit_test(c);
+        
+        /* the rest of a clause is a block or a single expression */
+        lval* body = clause->cell[1];
+        if (body->type == LVAL_QEXPR) {
+            if (!ljit_block(c, body, tail, loop)) { return 0; }
+        } else {
+            if (!ljit_expr(c, body, tail, loop)) { return 0; }
+        }
+        ends[ends_num++] = ljit_jmp(c);
+        ljit_patch(c, no, c->len);
+    }
+    
+    /* no clause matched, which is an error */
+    ljit_patch(c, ljit_jmp(c), c->bail);
+    for (int i = 0; i < ends_num; i++) { ljit_patch(c, ends[i], c->len); }
+    return 1;
+}
+
+/* evaluate arguments into fresh slots, the first argument at the lowest address */
+int ljit_args(ljit_ctx* c, lval* x, int* base) {
+    int n = x->count-1;
+    *base = c->depth;
+    for (int i = 0; i < n; i++) { ljit_slot(c); }
+    for (int i = 0; i < n; i++) {
+        if (!ljit_expr(c, x->cell[i+1], 0, NULL)) { return 0; }
+        ljit_store(c, *base + n-1-i);
+    }
+    return 1;
+}
+
+/* copy evaluated arguments into the slots of variables and jump back */
+void ljit_rebind(ljit_ctx* c, int base, int n, int first, int target) {
+    for (int i = 0; i < n; i++) {
+        ljit_load(c, 0, base + n-1-i);
+        ljit_store(c, first + i);
+    }
+    c->depth = base;
+    ljit_patch(c, ljit_jmp(c), target);
+}
+
+int ljit_loop_expr(ljit_ctx* c, lval* x, int tail) {
+    if (x->count != 3) { return 0; }
+    lval* binds = x->cell[1];
+    lval* body = x->cell[2];
+    if (binds->type != LVAL_QEXPR || body->type != LVAL_QEXPR) { return 0; }
+    if (binds->count % 2 != 0) { return 0; }
+    int n = binds->count / 2;
+    if (c->locals_num + n > LJIT_LOCALS) { return 0; }
+    
+    /* initial values are computed before any variable is in scope */
+    ljit_loop l;
+    l.first = c->depth;
+    l.count = n;
+    for (int i = 0; i < n; i++) { ljit_slot(c); }
+    for (int i = 0; i < n; i++) {
+        if (binds->cell[i*2]->type != LVAL_SYM) { return 0; }
+        if (!ljit_expr(c, binds->cell[i*2+1], 0, NULL)) { return 0; }
+        ljit_store(c, l.first + i);
+    }
+    
+    int locals = c->locals_num;
+    for (int i = 0; i < n; i++) {
+        c->locals[c->locals_num] = binds->cell[i*2]->sym;
+        c->slots[c->locals_num++] = l.first + i;
+    }
+    
+    l.head = c->len;
+    int ok = ljit_block(c, body, tail, &l);
+    c->locals_num = locals;
+    c->depth = l.first;
+    return ok;
+}
+
+int ljit_call(ljit_ctx* c, lval* x, int tail) {
+    if (x->count-1 != c->formals) { return 0; }
+    
+    int base;
+    if (!ljit_args(c, x, &base)) { return 0; }
+    
+    /* a call in tail position reuses the frame */
+    if (tail) {
+        ljit_rebind(c, base, c->formals, 0, c->body);
+        return 1;
+    }
+    
+    ljit_bytes(c, "\x48\x8D\xBD", 3); /* lea rdi, [rbp + disp32] */
+    ljit_u32(c, (unsigned int)(-8 * (base + c->formals)));
+    ljit_byte(c, 0xE8); /* call rel32 */
+    ljit_patch(c, ljit_rel(c), c->entry);
+    c->depth = base;
+    return 1;
+}
+
+int ljit_expr(ljit_ctx* c, lval* x, int tail, ljit_loop* loop) {
+    if (x->type == LVAL_NUM) { ljit_const(c, 0, x->num); return 1; }
+    
+    if (x->type == LVAL_SYM) {
+        int s = ljit_local(c, x);
+        if (s != -1) { ljit_load(c, 0, s); return 1; }
+        
+        /* global numbers are treated as constants */
+        lval* v = ljit_global(c, x);
+        if (!v || v->type != LVAL_NUM) { return 0; }
+        ljit_const(c, 0, v->num);
+        return 1;
+    }
+    
+    if (x->type != LVAL_SEXPR && x->type != LVAL_QEXPR) { return 0; }
+    if (x->count == 0) { return 0; }
+    if (x->count == 1) { return ljit_expr(c, x->cell[0], tail, loop); }
+    
+    /* the head must name a global function */
+    lval* k = x->cell[0];
+    if (k->type != LVAL_SYM || ljit_local(c, k) != -1) { return 0; }
+    lval* f = ljit_global(c, k);
+    if (!f || f->type != LVAL_FUN) { return 0; }
+    if (!f->builtin) { return ljit_call(c, x, tail); }
+    
+    lbuiltin b = f->builtin;
+    if (b == builtin_add) { return ljit_arith(c, x, 0x58); }
+    if (b == builtin_sub) { return ljit_arith(c, x, 0x5C); }
+    if (b == builtin_mul) { return ljit_arith(c, x, 0x59); }
+    if (b == builtin_div) { return ljit_arith(c, x, 0x5E); }
+    if (b == builtin_eq) { return ljit_compare(c, x, 0, 0); }
+    if (b == builtin_ne) { return ljit_compare(c, x, 4, 0); }
+    if (b == builtin_lt) { return ljit_compare(c, x, 1, 0); }
+    if (b == builtin_le) { return ljit_compare(c, x, 2, 0); }
+    if (b == builtin_gt) { return ljit_compare(c, x, 1, 1); }
+    if (b == builtin_ge) { return ljit_compare(c, x, 2, 1); }
+    if (b == builtin_if) { return ljit_if(c, x, tail, loop); }
+    if (b == builtin_select || b == builtin_cond) { return ljit_select(c, x, tail, loop); }
+    if (b == builtin_loop) { return ljit_loop_expr(c, x, tail); }
+    if (b == builtin_recur) {
+        /* only in tail position of the innermost loop */
+        if (!loop || x->count-1 != loop->count) { return 0; }
+        int base;
+        if (!ljit_args(c, x, &base)) { return 0; }
+        ljit_rebind(c, base, loop->count, loop->first, loop->head);
+        return 1;
+    }
+    return 0;
+}
+
+int ljit_compile(ljit_ctx* c, lval* f) {
+    lval* formals = f->formals;
+    if (formals->count > LJIT_LOCALS) { return 0; }
+    for (int i = 0; i < formals->count; i++) {
+        if (strcmp(formals->cell[i]->sym, "&") == 0) { return 0; }
+        c->locals[i] = formals->cell[i]->sym;
+        c->slots[i] = i;
+    }
+    c->formals = formals->count;
+    c->locals_num = formals->count;
+    c->depth = c->depth_max = formals->count;
+    
+    /* called from C with the arguments in rdi and the result pointer in rsi */
+    /* the stack pointer is kept in r12 so that any depth of calls can bail */
+    ljit_bytes(c, "\x55\x48\x89\xE5\x53\x41\x54", 7); /* push rbp; mov rbp, rsp; push rbx; push r12 */
+    ljit_bytes(c, "\x48\x89\xF3\x49\x89\xE4", 6); /* mov rbx, rsi; mov r12, rsp */
+    ljit_byte(c, 0xE8); /* call rel32 */
+    int call = ljit_rel(c);
+    ljit_bytes(c, "\xF2\x0F\x11\x03", 4); /* movsd [rbx], xmm0 */
+    ljit_bytes(c, "\x31\xC0", 2); /* xor eax, eax */
+    int ret = c->len;
+    ljit_bytes(c, "\x41\x5C\x5B\x5D\xC3", 5); /* pop r12; pop rbx; pop rbp; ret */
+    
+    c->bail = c->len;
+    ljit_bytes(c, "\x4C\x89\xE4", 3); /* mov rsp, r12 */
+    ljit_bytes(c, "\xB8\x01\x00\x00\x00", 5); /* mov eax, 1 */
+    ljit_patch(c, ljit_jmp(c), ret);
+    
+    /* the function itself takes a pointer to its arguments in rdi */
+    c->entry = c->len;
+    ljit_patch(c, call, c->entry);
+    ljit_bytes(c, "\x55\x48\x89\xE5\x48\x81\xEC", 7); /* push rbp; mov rbp, rsp; sub rsp, imm32 */
+    int frame = ljit_rel(c);
+    for (int i = 0; i < c->formals; i++) {
+        ljit_bytes(c, "\xF2\x0F\x10\x87", 4); /* movsd xmm0, [rdi + disp32] */
+        ljit_u32(c, 8 * i);
+        ljit_store(c, i);
+    }
+    c->body = c->len;
+    
+    if (!ljit_block(c, f->body, 1, NULL)) { return 0; }
+    ljit_bytes(c, "\x48\x89\xEC\x5D\xC3", 5); /* mov rsp, rbp; pop rbp; ret */
+    
+    unsigned int size = 8 * c->depth_max;
+    for (int i = 0; i < 4; i++) { c->code[frame+i] = (size >> (8*i)) & 0xFF; }
+    return 1;
+}
+
+#endif
+
+/* compile "f" into executable memory, leaving it for the interpreter on failure */
+void ljit_build(lenv* e, lval* f) {
+    ljit* j = f->jit;
+    j->state = -1;
+    
+    #ifdef LISSP_JIT
+    ljit_ctx c;
+    memset(&c, 0, sizeof(ljit_ctx));
+    c.jit = j;
+    c.root = e;
+    while (c.root->par) { c.root = c.root->par; }
+    
+    if (ljit_compile(&c, f)) {
+        void* code = mmap(NULL, c.len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code != MAP_FAILED) {
+            memcpy(code, c.code, c.len);
+            mprotect(code, c.len, PROT_READ | PROT_EXEC);
+            j->code = code;
+            j->size = c.len;
+            j->root = c.root;
+            j->version = c.root->version;
+            j->state = 1;
+            ljit_compiled++;
+        }
+    }
+    free(c.code);
+    #endif
+}
+
+/* run "f" natively if it can be, otherwise return NULL and leave "a" alone */
+lval* ljit_run(lenv* e, lval* f, lval* a) {
+    ljit* j = f->jit;
+    if (j->state == 0 && ++j->calls > LJIT_THRESHOLD) { ljit_build(e, f); }
+    if (j->state != 1 || a->count != f->formals->count) { return NULL; }
+    
+    double args[a->count+1];
+    for (int i = 0; i < a->count; i++) {
+        if (a->cell[i]->type != LVAL_NUM) { return NULL; }
+        args[i] = a->cell[i]->num;
+    }
+    if (!ljit_guards(j)) { return NULL; }
+    
+    /* the code only computes, so on any problem the call is simply run again */
+    double r;
+    ljit_entry entry = (ljit_entry)j->code;
+    if (entry(args, &r)) { ljit_bails++; return NULL; }
+    
+    ljit_runs++;
+    lval_del(a);
+    return lval_num(r);
+}
+
+lval* lval_call(lenv* e, lval* f, lval* a) {
+    if (lloop_depth) {
+        lval* err = lval_recur_arg(f, a);
+        if (err) { return err; }
+    }
+    
+    /* if builtin then call it */
+    if (f->builtin) { return f->builtin(e, a); }
+    
+    /* hot lambdas may run as native code */
+    if (f->jit) {
+        lval* x = ljit_run(e, f, a);
+        if (x) { return x; }
+    }
+    
+    /* record argument counts */
+    int given = a->count;
+    int total = f->formals->count;
+    
+    /* "f" may be borrowed from a call site cache, so it is never changed */
+    /* arguments are bound into a copy of its environment instead */
+    lenv* env = lenv_copy(f->env);
+    lval** formals = f->formals->cell;
+    int i = 0;
+    
+    /* while arguments still remain to be processed */
+    while (a->count) {
+        /* if we run out of formal arguments to bind */
+        if (i == total) {
+            lenv_del(env); lval_del(a); return lval_err(
+                "Function passed too many arguments. Got %i, expected &i.",
+                given, total);
+        }
+        
+        /* take next simbol from formals */
+        lval* sym = formals[i++];
+        
+        /* special case to deal with '&' */
+        if (strcmp(sym->sym, "&") == 0) {
+            if (total - i != 1) {
+                lenv_del(env); lval_del(a);
+                return lval_err("Function format invalid."
+                    "Symbol '&' not followed by single symbol.");
+            }
+            
+            lenv_put(env, formals[i++], builtin_list(e, a));
+            break;
+        }
+        
+        /* pop next argument from list */
+        lval* val = lval_pop(a, 0);
+        
+        /* bind copy into function's environment */
+        lenv_put(env, sym, val);
+        
+        lval_del(val);
+    }
+    /* argument list now bound -  free to be clean up */
+    lval_del(a);
+    
+    /* if '&' remains bind to empty list */
+    if (i < total && strcmp(formals[i]->sym, "&") == 0) {
+            
+            if (total - i != 2) {
+                lenv_del(env);
+                return lval_err("Function format invalid."
+                    "Symbol '&' not followed by single symbol.");
+            }
+            
+            lval* val = lval_qexpr();
+            lenv_put(env, formals[i+1], val);
+            lval_del(val);
+            i += 2;
+    }
+    
+    /* if all formals bound - evaluate */
+    if (i == total) {
+        /* set env parent to evaluation env */
+        env->par = e;
+        
+        lval* x = builtin_eval(
+            env, lval_add(lval_sexpr(), lval_copy(f->body)));
+        lenv_del(env);
+        
+        /* 'recur' only makes sense inside the body of a 'loop' */
+        if (x->type == LVAL_RECUR) {
+            lval_del(x);
+            return lval_err("Function 'recur' used outside of 'loop'.");
+        }
+        return x;
+    } else {
+        /* return partially evaluated function */
+        lval* rest = lval_qexpr();
+        for (; i < total; i++) { rest = lval_add(rest, lval_copy(formals[i])); }
+        lval* x = lval_lambda(rest, lval_copy(f->body));
+        lenv_del(x->env);
+        x->env = env;
+        return x;
+    }
+}
+
+/* the global function a call site names, or NULL if it must be looked up */
+lval* lcache_get(lenv* e, lval* v) {
+    lcache* c = v->cache;
+    if (!c) { return NULL; }
+    
+    /* only valid while the global binding is unchanged and nothing shadows it */
+    if (c->env && c->sym->version == c->version && c->sym->binds == 1) {
+        lcache_hits++;
+        return c->val;
+    }
+    lcache_misses++;
+    c->env = NULL;
+    if (c->sym->binds != 1) { return NULL; }
+    
+    lenv* g = e;
+    while (g->par) { g = g->par; }
+    lval* f = lenv_local(g, v->cell[0]);
+    if (!f || f->type != LVAL_FUN) { return NULL; }
+    
+    c->env = g;
+    c->version = c->sym->version;
+    c->val = f;
+    return f;
+}
+
+/* functions rebound while "lcache_held" is set, freed once no call holds them */
+lval** lcache_dead = NULL;
+int lcache_dead_count = 0;
+
+void lcache_bury(lval* v) {
+    lcache_dead_count++;
+    lcache_dead = realloc(lcache_dead, sizeof(lval*) * lcache_dead_count);
+    lcache_dead[lcache_dead_count-1] = v;
+}
+
+void lcache_release_held(void) {
+    if (--lcache_held || !lcache_dead_count) { return; }
+    for (int i = 0; i < lcache_dead_count; i++) { lval_del(lcache_dead[i]); }
+    free(lcache_dead);
+    lcache_dead = NULL;
+    lcache_dead_count = 0;
+}
+
+/* apply a list whose elements have already been evaluated */
+lval* lval_call_sexpr(lenv* e, lval* v) {
+    for (int i = 0; i < v->count; i++) { if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); } }
+    
+    if (v->count == 0) { return v; }
+    if (v->count == 1) { return lval_take(v, 0); }
+    
+    /* ensure first element is function after evaluation */
+    /* checks proven for this call site are about the arguments that remain */
+    int checked = v->checked;
+    lval* f = lval_pop(v, 0);
+    v->checked = checked;
+    if (f->type != LVAL_FUN) {
+        lval* err = lval_err(
+            "S-Expression starts with incorrect type. Got %s, expected %s.",
+            ltype_name(f->type), ltype_name(LVAL_FUN));
+        lval_del(f); lval_del(v);
+        return err;
+    }
+    /* if so call function to get result */
+    lval* result = lval_call(e, f, v);
+    lval_del(f);
+    return result;
+}
+
+/* call a global function found through a call site cache with arguments "a" */
+lval* lval_call_cached(lenv* e, lval* f, lval* a) {
+    for (int i = 0; i < a->count; i++) { if (a->cell[i]->type == LVAL_ERR) { return lval_take(a, i); } }
+    return lval_call(e, f, a);
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+
+    /* the head is evaluated first, and a cached function is held until */
+    /* it is called, even if evaluating the arguments rebinds its name */
+    lval* f = lcache_get(e, v);
+    if (f) {
+        int checked = v->checked;
+        lval_del(lval_pop(v, 0));
+        v->checked = checked;
+        lcache_held++;
+        for (int i = 0; i < v->count; i++) { v->cell[i] = lval_eval(e, v->cell[i]); }
+        lval* x = lval_call_cached(e, f, v);
+        lcache_release_held();
+        return x;
+    }
+    
+    for (int i = 0; i < v->count; i++) { v->cell[i] = lval_eval(e, v->cell[i]); }
+    return lval_call_sexpr(e, v);
+}
+
+lval* lval_eval(lenv* e, lval* v) {
+    if (v->type == LVAL_SYM) {
+        lval* x = lenv_get(e, v);
+        lval_del(v);
+        return x;
+    }
+    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    return v;
+}
+
+/* evaluate "v" while leaving it intact, so that loops can run it again */
+lval* lval_eval_keep(lenv* e, lval* v) {
+    if (v->type == LVAL_SYM) { return lenv_get(e, v); }
+    if (v->type != LVAL_SEXPR) { return lval_copy(v); }
+    
+    lval* x = lval_sexpr();
+    x->checked = v->checked;
+    
+    lval* f = lcache_get(e, v);
+    if (f) {
+        /* the head is left out, as it is already resolved */
+        x->count = v->count-1;
+        x->cell = malloc(sizeof(lval*) * x->count);
+        lcache_held++;
+        for (int i = 0; i < x->count; i++) { x->cell[i] = lval_eval_keep(e, v->cell[i+1]); }
+        lval* r = lval_call_cached(e, f, x);
+        lcache_release_held();
+        return r;
+    }
+    
+    x->count = v->count;
+    x->cell = malloc(sizeof(lval*) * v->count);
+    for (int i = 0; i < v->count; i++) { x->cell[i] = lval_eval_keep(e, v->cell[i]); }
+    return lval_call_sexpr(e, x);
+}        
+
+/* ahead of time compiler from a Lissp file to C */
+/* each top level function becomes a builtin, with a version working */
+/* purely on doubles that is used whenever it is passed only numbers */
+
+/* growable text buffer */
+typedef struct {
+    char* data;
+    int len;
+    int size;
+} abuf;
+
+void abuf_vprintf(abuf* b, char* fmt, va_list va) {
+    va_list copy;
+    va_copy(copy, va);
+    int n = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    
+    if (b->len + n + 1 > b->size) {
+        b->size = (b->len + n + 1) * 2;
+        b->data = realloc(b->data, b->size);
+    }
+    vsnprintf(b->data + b->len, n + 1, fmt, va);
+    b->len += n;
+}
+
+void abuf_printf(abuf* b, char* fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    abuf_vprintf(b, fmt, va);
+    va_end(va);
+}
+
+/* symbols may contain characters C identifiers cannot */
+void abuf_mangle(abuf* b, char* s) {
+    for (unsigned char* c = (unsigned char*)s; *c; c++) {
+        if (isalnum(*c)) { abuf_printf(b, "%c", *c); } else { abuf_printf(b, "_%02x", *c); }
+    }
+}
+
+void abuf_cstring(abuf* b, char* s) {
+    abuf_printf(b, "\"");
+    for (unsigned char* c = (unsigned char*)s; *c; c++) {
+        if (*c == '"' || *c == '\\') { abuf_printf(b, "\\%c", *c); }
+        else if (*c < 32 || *c > 126) { abuf_printf(b, "\\%03o", *c); }
+        else { abuf_printf(b, "%c", *c); }
+    }
+    abuf_printf(b, "\"");
+}
+
+void abuf_double(abuf* b, double x) {
+    if (isnan(x)) { abuf_printf(b, "NAN"); }
+    else if (isinf(x)) { abuf_printf(b, x > 0 ? "INFINITY" : "-INFINITY"); }
+    else { abuf_printf(b, "%.17g", x); }
+}
+
+/* a top level function of the file being compiled */
+typedef struct {
+    char* name;
+    lval* formals;
+    lval* body;
+    int num; /* whether it has a numeric version */
+} aot_fun;
+
+/* target of 'recur' inside a 'loop' being compiled */
+typedef struct {
+    int first; /* variable number of the first loop variable */
+    int count;
+} aot_loop;
+
+#define AOT_LOCALS 256
+
+typedef struct {
+    abuf* b;
+    int indent;
+    
+    lenv* root;
+    aot_fun* funs;
+    int funs_num;
+    aot_fun* self;
+    int top; /* whether a self tail call jumps back to the start */
+    
+    int temps;
+    int vars;
+    int locals_num;
+    char* locals[AOT_LOCALS];
+    int ids[AOT_LOCALS];
+} aot;
+
+void aot_line(aot* c, char* fmt, ...) {
+    for (int i = 0; i < c->indent; i++) { abuf_printf(c->b, "    "); }
+    va_list va;
+    va_start(va, fmt);
+    abuf_vprintf(c->b, fmt, va);
+    va_end(va);
+    abuf_printf(c->b, "\n");
+}
+
+int aot_temp(aot* c) {
+    int t = c->temps++;
+    aot_line(c, "double t%i = 0;", t);
+    return t;
+}
+
+int aot_local(aot* c, lval* k) {
+    for (int i = c->locals_num-1; i >= 0; i--) {
+        if (strcmp(c->locals[i], k->sym) == 0) { return c->ids[i]; }
+    }
+    return -1;
+}
+
+aot_fun* aot_find(aot* c, char* name) {
+    for (int i = 0; i < c->funs_num; i++) {
+        if (c->funs[i].num && strcmp(c->funs[i].name, name) == 0) { return &c->funs[i]; }
+    }
+    return NULL;
+}
+
+int aot_expr(aot* c, lval* x, int dest, int tail, aot_loop* loop);
+
+/* a value computed in the tail of a loop ends the loop */
+int aot_leaf(aot* c, aot_loop* loop) {
+    if (loop) { aot_line(c, "break;"); }
+    return 1;
+}
+
+int aot_block(aot* c, lval* x, int dest, int tail, aot_loop* loop) {
+    if (x->type != LVAL_QEXPR) { return 0; }
+    if (x->count == 1) { return aot_expr(c, x->cell[0], dest, tail, loop); }
+    return aot_expr(c, x, dest, tail, loop);
+}
+
+int aot_arith(aot* c, lval* x, int dest, char op, aot_loop* loop) {
+    int t = aot_temp(c);
+    if (!aot_expr(c, x->cell[1], t, 0, NULL)) { return 0; }
+    
+    /* a lone argument to '-' is negated */
+    if (x->count == 2 && op == '-') {
+        aot_line(c, "t%i = -t%i;", dest, t);
+        return aot_leaf(c, loop);
+    }
+    
+    aot_line(c, "t%i = t%i;", dest, t);
+    for (int i = 2; i < x->count; i++) {
+        int u = aot_temp(c);
+        if (!aot_expr(c, x->cell[i], u, 0, NULL)) { return 0; }
         
-        lval_del(expr);
-        lval_del(a);
-        
-        return lval_sexpr(); /* empty list */
+        /* dividing by zero is an error the interpreter reports */
+        if (op == '/') { aot_line(c, "if (t%i == 0) { return 0; }", u); }
+        aot_line(c, "t%i %c= t%i;", dest, op, u);
+    }
+    return aot_leaf(c, loop);
+}
+
+int aot_compare(aot* c, lval* x, int dest, char* op, aot_loop* loop) {
+    if (x->count != 3) { return 0; }
+    int a = aot_temp(c);
+    int b = aot_temp(c);
+    if (!aot_expr(c, x->cell[1], a, 0, NULL)) { return 0; }
+    if (!aot_expr(c, x->cell[2], b, 0, NULL)) { return 0; }
+    aot_line(c, "t%i = (t%i %s t%i);", dest, a, op, b);
+    return aot_leaf(c, loop);
+}
+
+int aot_if(aot* c, lval* x, int dest, int tail, aot_loop* loop) {
+    if (x->count != 4) { return 0; }
+    int t = aot_temp(c);
+    if (!aot_expr(c, x->cell[1], t, 0, NULL)) { return 0; }
+    
+    aot_line(c, "if (t%i != 0) {", t);
+    c->indent++;
+    if (!aot_block(c, x->cell[2], dest, tail, loop)) { return 0; }
+    c->indent--;
+    aot_line(c, "} else {");
+    c->indent++;
+    if (!aot_block(c, x->cell[3], dest, tail, loop)) { return 0; }
+    c->indent--;
+    aot_line(c, "}");
+    return 1;
+}
+
+int aot_select(aot* c, lval* x, int dest, int tail, aot_loop* loop) {
+    int indent = c->indent;
+    for (int i = 1; i < x->count; i++) {
+        lval* clause = x->cell[i];
+        if (clause->type != LVAL_QEXPR || clause->count != 2) { return 0; }
         
-    } else {
-        /* get parse error as string */
+        int t = aot_temp(c);
+        if (!aot_expr(c, clause->cell[0], t, 0, NULL)) { return 0; }
+        aot_line(c, "if (t%i != 0) {", t);
+        c->indent++;
+        
+        /* the rest of a clause is a block or a single expression */
+        lval* body = clause->cell[1];
+        int ok = body->type == LVAL_QEXPR
+            ? aot_block(c, body, dest, tail, loop)
+            : aot_expr(c, body, dest, tail, loop);
+        if (!ok) { return 0; }
+        
+        c->indent--;
+        aot_line(c, "} else {");
+        c->indent++;
+    }
+    
+    /* no clause matched, which is an error */
+    aot_line(c, "return 0;");
+    while (c->indent > indent) {
+        c->indent--;
+        aot_line(c, "}");
+    }
+    return 1;
+}
+
+/* evaluate the arguments of "x" into consecutive temporaries */
+int aot_args(aot* c, lval* x) {
+    int first = c->temps;
+    for (int i = 1; i < x->count; i++) { aot_temp(c); }
+    for (int i = 1; i < x->count; i++) {
+        if (!aot_expr(c, x->cell[i], first + i-1, 0, NULL)) { return -1; }
+    }
+    return first;
+}
+
+int aot_call(aot* c, aot_fun* f, lval* x, int dest, int tail, aot_loop* loop) {
+    int n = x->count-1;
+    if (n != f->formals->count) { return 0; }
+    int first = aot_args(c, x);
+    if (first == -1) { return 0; }
+    
+    /* a call to itself in tail position jumps back to the start */
+    if (tail && f == c->self) {
+        for (int i = 0; i < n; i++) { aot_line(c, "v%i = t%i;", i, first + i); }
+        aot_line(c, "goto top;");
+        c->top = 1;
+        return 1;
+    }
+    
+    abuf call = {NULL, 0, 0};
+    abuf_printf(&call, "if (!aot_num_");
+    abuf_mangle(&call, f->name);
+    abuf_printf(&call, "(");
+    for (int i = 0; i < n; i++) { abuf_printf(&call, "t%i, ", first + i); }
+    abuf_printf(&call, "&t%i)) { return 0; }", dest);
+    aot_line(c, "%s", call.data);
+    free(call.data);
+    return aot_leaf(c, loop);
+}
+
+int aot_loop_expr(aot* c, lval* x, int dest, int tail, aot_loop* outer) {
+    if (x->count != 3) { return 0; }
+    lval* binds = x->cell[1];
+    lval* body = x->cell[2];
+    if (binds->type != LVAL_QEXPR || body->type != LVAL_QEXPR) { return 0; }
+    if (binds->count % 2 != 0) { return 0; }
+    int n = binds->count / 2;
+    if (c->locals_num + n > AOT_LOCALS) { return 0; }
+    
+    /* initial values are computed before any variable is in scope */
+    aot_loop l;
+    l.first = c->vars;
+    l.count = n;
+    c->vars += n;
+    for (int i = 0; i < n; i++) {
+        if (binds->cell[i*2]->type != LVAL_SYM) { return 0; }
+        int t = aot_temp(c);
+        if (!aot_expr(c, binds->cell[i*2+1], t, 0, NULL)) { return 0; }
+        aot_line(c, "double v%i = t%i;", l.first + i, t);
+    }
+    
+    int locals = c->locals_num;
+    for (int i = 0; i < n; i++) {
+        c->locals[c->locals_num] = binds->cell[i*2]->sym;
+        c->ids[c->locals_num++] = l.first + i;
+    }
+    
+    aot_line(c, "for (;;) {");
+    c->indent++;
+    int ok = aot_block(c, body, dest, tail, &l);
+    c->indent--;
+    aot_line(c, "}");
+    c->locals_num = locals;
+    return ok && aot_leaf(c, outer);
+}
+
+int aot_expr(aot* c, lval* x, int dest, int tail, aot_loop* loop) {
+    if (x->type == LVAL_NUM) {
+        abuf num = {NULL, 0, 0};
+        abuf_double(&num, x->num);
+        aot_line(c, "t%i = %s;", dest, num.data);
+        free(num.data);
+        return aot_leaf(c, loop);
+    }
+    
+    if (x->type == LVAL_SYM) {
+        int id = aot_local(c, x);
+        if (id != -1) {
+            aot_line(c, "t%i = v%i;", dest, id);
+            return aot_leaf(c, loop);
+        }
+        
+        /* numbers the prelude defines, such as 'otherwise', are inlined */
+        lval* v = lenv_local(c->root, x);
+        if (!v || v->type != LVAL_NUM) { return 0; }
+        lval* n = lval_num(v->num);
+        int ok = aot_expr(c, n, dest, tail, loop);
+        lval_del(n);
+        return ok;
+    }
+    
+    if (x->type != LVAL_SEXPR && x->type != LVAL_QEXPR) { return 0; }
+    if (x->count == 0) { return 0; }
+    if (x->count == 1) { return aot_expr(c, x->cell[0], dest, tail, loop); }
+    
+    lval* k = x->cell[0];
+    if (k->type != LVAL_SYM || aot_local(c, k) != -1) { return 0; }
+    
+    /* functions of the same file are called directly */
+    aot_fun* f = aot_find(c, k->sym);
+    if (f) { return aot_call(c, f, x, dest, tail, loop); }
+    
+    lval* v = lenv_local(c->root, k);
+    if (!v || v->type != LVAL_FUN || !v->builtin) { return 0; }
+    
+    lbuiltin b = v->builtin;
+    if (b == builtin_add) { return aot_arith(c, x, dest, '+', loop); }
+    if (b == builtin_sub) { return aot_arith(c, x, dest, '-', loop); }
+    if (b == builtin_mul) { return aot_arith(c, x, dest, '*', loop); }
+    if (b == builtin_div) { return aot_arith(c, x, dest, '/', loop); }
+    if (b == builtin_eq) { return aot_compare(c, x, dest, "==", loop); }
+    if (b == builtin_ne) { return aot_compare(c, x, dest, "!=", loop); }
+    if (b == builtin_lt) { return aot_compare(c, x, dest, "<", loop); }
+    if (b == builtin_le) { return aot_compare(c, x, dest, "<=", loop); }
+    if (b == builtin_gt) { return aot_compare(c, x, dest, ">", loop); }
+    if (b == builtin_ge) { return aot_compare(c, x, dest, ">=", loop); }
+    if (b == builtin_if) { return aot_if(c, x, dest, tail, loop); }
+    if (b == builtin_select || b == builtin_cond) { return aot_select(c, x, dest, tail, loop); }
+    if (b == builtin_loop) { return aot_loop_expr(c, x, dest, tail, loop); }
+    if (b == builtin_recur) {
+        /* only in tail position of the innermost loop */
+        if (!loop || x->count-1 != loop->count) { return 0; }
+        int first = aot_args(c, x);
+        if (first == -1) { return 0; }
+        for (int i = 0; i < loop->count; i++) {
+            aot_line(c, "v%i = t%i;", loop->first + i, first + i);
+        }
+        aot_line(c, "continue;");
+        return 1;
+    }
+    return 0;
+}
+
+void aot_signature(abuf* b, aot_fun* f) {
+    abuf_printf(b, "int aot_num_");
+    abuf_mangle(b, f->name);
+    abuf_printf(b, "(");
+    for (int i = 0; i < f->formals->count; i++) { abuf_printf(b, "double v%i, ", i); }
+    abuf_printf(b, "double* r)");
+}
+
+/* compile the numeric version of "f", returning NULL if it has none */
+char* aot_num_fun(aot* c, aot_fun* f) {
+    if (f->formals->count > AOT_LOCALS) { return NULL; }
+    
+    abuf body = {NULL, 0, 0};
+    c->b = &body;
+    c->indent = 1;
+    c->self = f;
+    c->top = 0;
+    c->temps = 0;
+    c->vars = f->formals->count;
+    c->locals_num = f->formals->count;
+    for (int i = 0; i < f->formals->count; i++) {
+        c->locals[i] = f->formals->cell[i]->sym;
+        c->ids[i] = i;
+    }
+    
+    aot_line(c, "double t0 = 0;");
+    c->temps = 1;
+    if (!aot_block(c, f->body, 0, 1, NULL)) { free(body.data); return NULL; }
+    aot_line(c, "*r = t0;");
+    aot_line(c, "return 1;");
+    
+    abuf out = {NULL, 0, 0};
+    aot_signature(&out, f);
+    abuf_printf(&out, " {\n");
+    if (c->top) { abuf_printf(&out, "top:;\n"); }
+    abuf_printf(&out, "%s}\n\n", body.data);
+    free(body.data);
+    return out.data;
+}
+
+/* emit code building "v" as it was read, returning its variable number */
+int aot_const(abuf* b, lval* v, int* n) {
+    int id = (*n)++;
+    abuf_printf(b, "    lval* c%i = ", id);
+    switch (v->type) {
+        case LVAL_NUM: abuf_printf(b, "lval_num("); abuf_double(b, v->num); abuf_printf(b, ");\n"); break;
+        case LVAL_SYM: abuf_printf(b, "lval_sym("); abuf_cstring(b, v->sym); abuf_printf(b, ");\n"); break;
+        case LVAL_STR: abuf_printf(b, "lval_str("); abuf_cstring(b, v->str); abuf_printf(b, ");\n"); break;
+        default:
+            abuf_printf(b, v->type == LVAL_QEXPR ? "lval_qexpr();\n" : "lval_sexpr();\n");
+            for (int i = 0; i < v->count; i++) {
+                int child = aot_const(b, v->cell[i], n);
+                abuf_printf(b, "    lval_add(c%i, c%i);\n", id, child);
+            }
+            abuf_printf(b, "    lval_read_site(c%i);\n", id);
+        break;
+    }
+    return id;
+}
+
+void aot_const_fun(abuf* b, char* name, int index, lval* v) {
+    int n = 0;
+    abuf_printf(b, "lval* aot_%s_%i(void) {\n", name, index);
+    int id = aot_const(b, v, &n);
+    abuf_printf(b, "    return c%i;\n}\n\n", id);
+}
+
+/* recognise '(fun {name formals...} {body})' and '(def {name} (\ {formals} {body}))' */
+int aot_definition(lval* x, aot_fun* f) {
+    if (x->type != LVAL_SEXPR || x->count != 3 || x->cell[0]->type != LVAL_SYM) { return 0; }
+    lval* names = x->cell[1];
+    if (names->type != LVAL_QEXPR || names->count < 1) { return 0; }
+    for (int i = 0; i < names->count; i++) {
+        if (names->cell[i]->type != LVAL_SYM) { return 0; }
+    }
+    
+    if (strcmp(x->cell[0]->sym, "fun") == 0 && x->cell[2]->type == LVAL_QEXPR) {
+        f->name = names->cell[0]->sym;
+        f->formals = lval_qexpr();
+        for (int i = 1; i < names->count; i++) { lval_add(f->formals, lval_copy(names->cell[i])); }
+        f->body = lval_copy(x->cell[2]);
+        return 1;
+    }
+    
+    lval* l = x->cell[2];
+    if (strcmp(x->cell[0]->sym, "def") == 0 && names->count == 1
+        && l->type == LVAL_SEXPR && l->count == 3
+        && l->cell[0]->type == LVAL_SYM && strcmp(l->cell[0]->sym, "\\") == 0
+        && l->cell[1]->type == LVAL_QEXPR && l->cell[2]->type == LVAL_QEXPR) {
+        for (int i = 0; i < l->cell[1]->count; i++) {
+            if (l->cell[1]->cell[i]->type != LVAL_SYM) { return 0; }
+        }
+        f->name = names->cell[0]->sym;
+        f->formals = lval_copy(l->cell[1]);
+        f->body = lval_copy(l->cell[2]);
+        return 1;
+    }
+    return 0;
+}
+
+/* write C for "file" to "out", to be built in with -DLISSP_AOT */
+lval* aot_emit(lenv* e, char* file, FILE* out) {
+    mpc_result_t r;
+    if (!mpc_parse_contents(file, Lissp, &r)) {
         char* err_msg = mpc_err_string(r.error);
         mpc_err_delete(r.error);
-        
-        /* create new error message using it */
         lval* err = lval_err("Could not load library %s", err_msg);
-      	
         free(err_msg);
-        lval_del(a);
         return err;
     }
+    lval* expr = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    
+    aot c;
+    memset(&c, 0, sizeof(aot));
+    c.root = e;
+    c.funs = malloc(sizeof(aot_fun) * (expr->count+1));
+    int* kinds = malloc(sizeof(int) * (expr->count+1));
+    for (int i = 0; i < expr->count; i++) {
+        kinds[i] = aot_definition(expr->cell[i], &c.funs[c.funs_num]);
+        if (kinds[i]) {
+            c.funs[c.funs_num].num = 1;
+            for (int j = 0; j < c.funs[c.funs_num].formals->count; j++) {
+                if (strcmp(c.funs[c.funs_num].formals->cell[j]->sym, "&") == 0) {
+                    c.funs[c.funs_num].num = 0;
+                }
+            }
+            c.funs_num++;
+        }
+    }
+    
+    /* drop numeric versions until every one left only calls numeric versions */
+    char** nums = calloc(c.funs_num+1, sizeof(char*));
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < c.funs_num; i++) {
+            free(nums[i]);
+            nums[i] = NULL;
+            if (!c.funs[i].num) { continue; }
+            nums[i] = aot_num_fun(&c, &c.funs[i]);
+            if (!nums[i]) { c.funs[i].num = 0; changed = 1; }
+        }
+    }
+    
+    abuf b = {NULL, 0, 0};
+    abuf_printf(&b, "/* generated by 'lissp --emit-c %s', do not edit */\n", file);
+    abuf_printf(&b, "/* numeric versions assume the builtins and these functions are never rebound */\n\n");
+    
+    for (int i = 0; i < c.funs_num; i++) {
+        if (c.funs[i].num) { aot_signature(&b, &c.funs[i]); abuf_printf(&b, ";\n"); }
+    }
+    abuf_printf(&b, "\n");
+    for (int i = 0; i < c.funs_num; i++) {
+        if (nums[i]) { abuf_printf(&b, "%s", nums[i]); }
+    }
+    
+    for (int i = 0, fun = 0; i < expr->count; i++) {
+        if (!kinds[i]) { aot_const_fun(&b, "form", i, expr->cell[i]); continue; }
+        aot_fun* f = &c.funs[fun++];
+        aot_const_fun(&b, "formals", i, f->formals);
+        aot_const_fun(&b, "body", i, f->body);
+        
+        /* the builtin runs the numeric version when it can, and the lambda otherwise */
+        abuf_printf(&b, "lval* aot_");
+        abuf_mangle(&b, f->name);
+        abuf_printf(&b, "(lenv* e, lval* a) {\n");
+        abuf_printf(&b, "    static lval* f = NULL;\n");
+        abuf_printf(&b, "    if (!f) { f = lval_lambda(aot_formals_%i(), aot_body_%i()); }\n", i, i);
+        if (f->num) {
+            int n = f->formals->count;
+            abuf_printf(&b, "    if (a->count == %i", n);
+            for (int j = 0; j < n; j++) { abuf_printf(&b, " && a->cell[%i]->type == LVAL_NUM", j); }
+            abuf_printf(&b, ") {\n        double r;\n        if (aot_num_");
+            abuf_mangle(&b, f->name);
+            abuf_printf(&b, "(");
+            for (int j = 0; j < n; j++) { abuf_printf(&b, "a->cell[%i]->num, ", j); }
+            abuf_printf(&b, "&r)) { lval_del(a); return lval_num(r); }\n    }\n");
+        }
+        abuf_printf(&b, "    return lval_call(e, f, a);\n}\n\n");
+    }
+    
+    /* named like lbuiltins, so that images can refer to them */
+    abuf_printf(&b, "lbuiltin_info laot_builtins[] = {\n");
+    for (int i = 0; i < c.funs_num; i++) {
+        aot_fun* f = &c.funs[i];
+        int min = f->formals->count, max = min;
+        for (int j = 0; j < f->formals->count; j++) {
+            if (strcmp(f->formals->cell[j]->sym, "&") == 0) { min = j; max = -1; break; }
+        }
+        abuf_printf(&b, "    {");
+        abuf_cstring(&b, f->name);
+        abuf_printf(&b, ", aot_");
+        abuf_mangle(&b, f->name);
+        abuf_printf(&b, ", %i, %i, \"*\", '*'},\n", min, max);
+    }
+    abuf_printf(&b, "    {NULL, NULL, 0, 0, NULL, 0}\n};\n\n");
+    
+    /* definitions become builtins, everything else is evaluated in order */
+    abuf_printf(&b, "void lenv_add_aot(lenv* e) {\n");
+    for (int i = 0, fun = 0; i < expr->count; i++) {
+        if (kinds[i]) {
+            aot_fun* f = &c.funs[fun++];
+            abuf_printf(&b, "    lenv_add_builtin(e, ");
+            abuf_cstring(&b, f->name);
+            abuf_printf(&b, ", aot_");
+            abuf_mangle(&b, f->name);
+            abuf_printf(&b, ");\n");
+        } else {
+            abuf_printf(&b, "    {\n        lval* x = lval_eval(e, aot_form_%i());\n", i);
+            abuf_printf(&b, "        if (x->type == LVAL_ERR) { lval_println(x); }\n");
+            abuf_printf(&b, "        lval_del(x);\n    }\n");
+        }
+    }
+    abuf_printf(&b, "}\n");
+    fputs(b.data, out);
+    
+    free(b.data);
+    for (int i = 0; i < c.funs_num; i++) {
+        free(nums[i]);
+        lval_del(c.funs[i].formals);
+        lval_del(c.funs[i].body);
+    }
+    free(nums);
+    free(kinds);
+    free(c.funs);
+    lval_del(expr);
+    return lval_sexpr();
+}
+
+/* images hold the global environment in a binary form that loads */
+/* without parsing or evaluating anything */
+/* a header of LIMAGE_MAGIC, the build string and LIMAGE_FORMAT */
+/* is followed by the number of bindings, then each name and value */
+#define LIMAGE_MAGIC "LSPI"
+#define LIMAGE_FORMAT 1
+
+void abuf_bytes(abuf* b, void* data, int n) {
+    if (b->len + n + 1 > b->size) {
+        b->size = (b->len + n + 1) * 2;
+        b->data = realloc(b->data, b->size);
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+void abuf_u32(abuf* b, unsigned long x) {
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++) { bytes[i] = (x >> (8*i)) & 0xFF; }
+    abuf_bytes(b, bytes, 4);
+}
+
+void abuf_string(abuf* b, char* s) {
+    abuf_u32(b, strlen(s));
+    abuf_bytes(b, s, strlen(s));
+}
+
+char* lbuiltin_name(lbuiltin func) {
+    for (int t = 0; t < 2; t++) {
+        for (lbuiltin_info* b = lbuiltin_tables[t]; b->name; b++) {
+            if (b->func == func) { return b->name; }
+        }
+    }
+    return NULL;
+}
+
+lbuiltin lbuiltin_named(char* name) {
+    for (int t = 0; t < 2; t++) {
+        for (lbuiltin_info* b = lbuiltin_tables[t]; b->name; b++) {
+            if (strcmp(b->name, name) == 0) { return b->func; }
+        }
+    }
+    return NULL;
+}
+
+/* images and caches are only read by the build that wrote them, known by */
+/* the version and either -DLISSP_BUILD_ID or a hash of every builtin signature */
+char* lbuild_id(void) {
+    static char id[256];
+    if (id[0]) { return id; }
+    #ifdef LISSP_BUILD_ID
+    snprintf(id, sizeof(id), "%s+%s", LISSP_VERSION, LISSP_BUILD_ID);
+    #else
+    unsigned long long h = 14695981039346656037ULL;
+    for (int t = 0; t < 2; t++) {
+        for (lbuiltin_info* b = lbuiltin_tables[t]; b->name; b++) {
+            char sig[512];
+            snprintf(sig, sizeof(sig), "%s %i %i %s %c;", b->name, b->min, b->max, b->args, b->ret);
+            for (unsigned char* c = (unsigned char*)sig; *c; c++) { h = (h ^ *c) * 1099511628211ULL; }
+        }
+    }
+    snprintf(id, sizeof(id), "%s+%016llx", LISSP_VERSION, h);
+    #endif
+    return id;
+}
+
+int lenv_save(abuf* b, lenv* e, int global);
+
+/* returns 0 if "v" holds something an image cannot */
+int lval_save(abuf* b, lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: {
+            unsigned long long bits;
+            memcpy(&bits, &v->num, sizeof(double));
+            abuf_bytes(b, "n", 1);
+            abuf_u32(b, bits & 0xFFFFFFFF);
+            abuf_u32(b, bits >> 32);
+            return 1;
+        }
+        case LVAL_ERR: abuf_bytes(b, "e", 1); abuf_string(b, v->err); return 1;
+        case LVAL_SYM: abuf_bytes(b, "y", 1); abuf_string(b, v->sym); return 1;
+        case LVAL_STR: abuf_bytes(b, "s", 1); abuf_string(b, v->str); return 1;
+        case LVAL_FUN:
+            /* builtins are stored by name and found again when loaded */
+            if (v->builtin) {
+                char* name = lbuiltin_name(v->builtin);
+                if (!name) { return 0; }
+                abuf_bytes(b, "b", 1);
+                abuf_string(b, name);
+                return 1;
+            }
+            abuf_bytes(b, "f", 1);
+            return lenv_save(b, v->env, 0) && lval_save(b, v->formals) && lval_save(b, v->body);
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            abuf_bytes(b, v->type == LVAL_SEXPR ? "(" : "{", 1);
+            abuf_u32(b, v->count);
+            for (int i = 0; i < v->count; i++) {
+                if (!lval_save(b, v->cell[i])) { return 0; }
+            }
+            return 1;
+        default: return 0;
+    }
+}
+
+/* builtins bound to their own names in the global environment are left out */
+int lenv_save_skip(lenv* e, int i, int global) {
+    lval* v = e->vals[i];
+    if (!global || v->type != LVAL_FUN || !v->builtin) { return 0; }
+    for (int t = 0; t < 2; t++) {
+        for (lbuiltin_info* b = lbuiltin_tables[t]; b->name; b++) {
+            if (b->func == v->builtin && strcmp(b->name, e->syms[i]) == 0) { return 1; }
+        }
+    }
+    return 0;
+}
+
+int lenv_save(abuf* b, lenv* e, int global) {
+    int count = 0;
+    for (int i = 0; i < e->count; i++) { if (!lenv_save_skip(e, i, global)) { count++; } }
+    
+    abuf_u32(b, count);
+    for (int i = 0; i < e->count; i++) {
+        if (lenv_save_skip(e, i, global)) { continue; }
+        abuf_string(b, e->syms[i]);
+        if (!lval_save(b, e->vals[i])) { return 0; }
+    }
+    return 1;
 }
 
-void lenv_add_builtins(lenv* e) {
-    /* list functions */
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head); lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "eval", builtin_eval); lenv_add_builtin(e, "join", builtin_join);
-    
-    /* mathematical functions */
-    lenv_add_builtin(e, "+", builtin_add); lenv_add_builtin(e, "-", builtin_sub);
-    lenv_add_builtin(e, "*", builtin_mul); lenv_add_builtin(e, "/", builtin_div);
-    lenv_add_builtin(e, "max", builtin_max); lenv_add_builtin(e, "min", builtin_max);
-    lenv_add_builtin(e, "%", builtin_mod);
+/* write an image of the global environment "e" to "b" */
+lval* limage_save(abuf* b, lenv* e) {
+    abuf_bytes(b, LIMAGE_MAGIC, 4);
+    abuf_bytes(b, lbuild_id(), strlen(lbuild_id())+1);
+    abuf_u32(b, LIMAGE_FORMAT);
+    lenv_force_all(e);
+    if (!lenv_save(b, e, 1)) {
+        return lval_err("Could not save image. Only builtins and values read from source can be saved.");
+    }
+    return lval_sexpr();
+}
+
+typedef struct {
+    const unsigned char* data;
+    unsigned long len;
+    unsigned long pos;
+} limage;
+
+int limage_u32(limage* m, unsigned long* x) {
+    if (m->len - m->pos < 4) { return 0; }
+    *x = 0;
+    for (int i = 0; i < 4; i++) { *x |= (unsigned long)m->data[m->pos++] << (8*i); }
+    return 1;
+}
+
+/* strings are copied out, as lvals own their strings */
+char* limage_string(limage* m) {
+    unsigned long n;
+    if (!limage_u32(m, &n) || m->len - m->pos < n) { return NULL; }
+    char* s = malloc(n+1);
+    memcpy(s, m->data + m->pos, n);
+    s[n] = '\0';
+    m->pos += n;
+    return s;
+}
+
+int limage_env(limage* m, lenv* e, lenv* builtins);
+
+/* read one value, or return NULL if the image is damaged */
+lval* limage_lval(limage* m, lenv* builtins) {
+    if (m->pos >= m->len) { return NULL; }
+    char tag = m->data[m->pos++];
     
-    /* variable functions */
-    lenv_add_builtin(e, "\\", builtin_lambda);
-    lenv_add_builtin(e, "def", builtin_def);
-    lenv_add_builtin(e, "=", builtin_put);
+    switch (tag) {
+        case 'n': {
+            unsigned long lo, hi;
+            if (!limage_u32(m, &lo) || !limage_u32(m, &hi)) { return NULL; }
+            unsigned long long bits = ((unsigned long long)hi << 32) | lo;
+            double x;
+            memcpy(&x, &bits, sizeof(double));
+            return lval_num(x);
+        }
+        case 'e': case 'y': case 's': case 'b': {
+            char* s = limage_string(m);
+            if (!s) { return NULL; }
+            lval* v;
+            if (tag == 'e') { v = lval_err("%s", s); }
+            else if (tag == 'y') { v = lval_sym(s); }
+            else if (tag == 's') { v = lval_str(s); }
+            else {
+                /* builtins come from the running interpreter, and compiled */
+                /* functions from its table as they are not bound yet */
+                lval* k = lval_sym(s);
+                lval* f = builtins ? lenv_local(builtins, k) : NULL;
+                lval_del(k);
+                lbuiltin func = lbuiltin_named(s);
+                if (f && f->type == LVAL_FUN && f->builtin) { v = lval_copy(f); }
+                else { v = func ? lval_builtin(func) : NULL; }
+            }
+            free(s);
+            return v;
+        }
+        case 'f': {
+            lenv* env = lenv_new();
+            lval* formals = NULL;
+            lval* body = NULL;
+            if (limage_env(m, env, builtins)
+                && (formals = limage_lval(m, builtins))
+                && (body = limage_lval(m, builtins))) {
+                lval* f = lval_lambda(formals, body);
+                lenv_del(f->env);
+                f->env = env;
+                ljit_attach(f);
+                return f;
+            }
+            if (formals) { lval_del(formals); }
+            lenv_del(env);
+            return NULL;
+        }
+        case '(': case '{': {
+            unsigned long count;
+            if (!limage_u32(m, &count)) { return NULL; }
+            lval* x = tag == '(' ? lval_sexpr() : lval_qexpr();
+            for (unsigned long i = 0; i < count; i++) {
+                lval* y = limage_lval(m, builtins);
+                if (!y) { lval_del(x); return NULL; }
+                lval_add(x, y);
+            }
+            /* prepare call sites just as the reader does */
+            lval_read_site(x);
+            return x;
+        }
+    }
+    return NULL;
+}
+
+int limage_env(limage* m, lenv* e, lenv* builtins) {
+    unsigned long count;
+    if (!limage_u32(m, &count)) { return 0; }
+    for (unsigned long i = 0; i < count; i++) {
+        char* name = limage_string(m);
+        if (!name) { return 0; }
+        lval* k = lval_sym(name);
+        free(name);
+        lval* v = limage_lval(m, builtins);
+        if (!v) { lval_del(k); return 0; }
+        lenv_put(e, k, v);
+        lval_del(k); lval_del(v);
+    }
+    return 1;
+}
+
+/* load an image into the global environment "e", which already has its builtins */
+lval* limage_load(lenv* e, const unsigned char* data, unsigned long len) {
+    limage m = {data, len, 0};
+    unsigned long format;
+    char* id = lbuild_id();
+    unsigned long header = 4 + strlen(id)+1;
+    if (len < 4 || memcmp(data, LIMAGE_MAGIC, 4) != 0) {
+        return lval_err("Image was not made by Lissp.");
+    }
+    if (len < header || memcmp(data+4, id, strlen(id)+1) != 0) {
+        const unsigned char* end = memchr(data+4, '\0', len-4 < 256 ? len-4 : 256);
+        if (!end) { return lval_err("Image was made by another build of Lissp, this is %s.", id); }
+        return lval_err("Image was made by Lissp %s, this is %s.", (char*)data+4, id);
+    }
+    m.pos = header;
+    if (!limage_u32(&m, &format) || format != LIMAGE_FORMAT) {
+        return lval_err("Image format is not %i.", LIMAGE_FORMAT);
+    }
     
-    /* comparison functions */
-    lenv_add_builtin(e, "if", builtin_if);
-    lenv_add_builtin(e, "==", builtin_eq);
-    lenv_add_builtin(e, "!=", builtin_ne);
-    lenv_add_builtin(e, ">", builtin_gt);
-    lenv_add_builtin(e, "<", builtin_lt);
-    lenv_add_builtin(e, ">=", builtin_ge);
-    lenv_add_builtin(e, "<=", builtin_le);
+    /* bindings are read into a new environment so a damaged image changes nothing */
+    lenv* n = lenv_new();
+    if (!limage_env(&m, n, e) || m.pos != m.len) {
+        lenv_del(n);
+        return lval_err("Image is damaged.");
+    }
+    for (int i = 0; i < n->count; i++) {
+        lval* k = lval_sym(n->syms[i]);
+        lenv_put(e, k, n->vals[i]);
+        lval_del(k);
+    }
+    lenv_del(n);
+    return lval_sexpr();
+}
+
+/* print an image of "e" as a C array for -DLISSP_PRELUDE */
+lval* limage_emit(lenv* e, FILE* out) {
+    abuf b = {NULL, 0, 0};
+    lval* x = limage_save(&b, e);
+    if (x->type == LVAL_ERR) { free(b.data); return x; }
     
-    /* string functions */
-    lenv_add_builtin(e, "load", builtin_load);
-    lenv_add_builtin(e, "error", builtin_error);
-    lenv_add_builtin(e, "print", builtin_print);    
+    fprintf(out, "/* generated by 'lissp --emit-prelude', do not edit */\n");
+    fprintf(out, "static const unsigned char lissp_prelude[] = {");
+    for (int i = 0; i < b.len; i++) {
+        fprintf(out, i % 12 ? " 0x%02x," : "\n    0x%02x,", (unsigned char)b.data[i]);
+    }
+    fprintf(out, "\n};\n");
+    free(b.data);
+    return x;
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-    /* if builtin then call it */
-    if (f->builtin) { return f->builtin(e, a); }
+/* map a whole file for reading, or read it where that is not possible */
+unsigned char* lfile_map(char* path, unsigned long* len) {
+    #ifdef LISSP_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) { return NULL; }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) { close(fd); return NULL; }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { return NULL; }
+    *len = st.st_size;
+    return data;
+    #else
+    FILE* f = fopen(path, "rb");
+    if (!f) { return NULL; }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* data = size > 0 ? malloc(size) : NULL;
+    if (data && fread(data, 1, size, f) != (size_t)size) { free(data); data = NULL; }
+    fclose(f);
+    *len = size;
+    return data;
+    #endif
+}
+
+void lfile_unmap(unsigned char* data, unsigned long len) {
+    #ifdef LISSP_MMAP
+    munmap(data, len);
+    #else
+    free(data);
+    #endif
+}
+
+/* load an image file into the global environment "e" */
+lval* limage_load_file(lenv* e, char* path) {
+    unsigned long len;
+    unsigned char* data = lfile_map(path, &len);
+    if (!data) { return lval_err("Could not open image %s", path); }
+    lval* x = limage_load(e, data, len);
+    lfile_unmap(data, len);
+    return x;
+}
+
+lval* builtin_save_image(lenv* e, lval* a) {
+    LASSERT_NUM("save-image", a, 1);
+    LASSERT_TYPE("save-image", a, 0, LVAL_STR);
     
-    /* record argument counts */
-    int given = a->count;
-    int total = f->formals->count;
+    /* the image is always of the global environment */
+    while (e->par) { e = e->par; }
     
-    /* while arguments still remain to be processed */
-    while (a->count) {
-        /* if we run out of formal arguments to bind */
-        if (f->formals->count == 0) {
-            lval_del(a); return lval_err(
-                "Function passed too many arguments. Got %i, expected &i.",
-                given, total);
+    abuf b = {NULL, 0, 0};
+    lval* x = limage_save(&b, e);
+    if (x->type != LVAL_ERR) {
+        FILE* f = fopen(a->cell[0]->str, "wb");
+        if (!f || fwrite(b.data, 1, b.len, f) != (size_t)b.len) {
+            lval_del(x);
+            x = lval_err("Could not write image %s", a->cell[0]->str);
         }
-        
-        /* pop first simbol from formals */
-        lval* sym = lval_pop(f->formals, 0);
-        
-        /* special case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
-            if (f->formals->count != 1) {
-                lval_del(a);
-                return lval_err("Function format invalid."
-                    "Symbol '&' not followed by single symbol.");
-            }
+        if (f) { fclose(f); }
+    }
+    free(b.data);
+    lval_del(a);
+    return x;
+}
+
+/* the forms read from a file are kept next to it in a ".lsspc" file */
+/* a header of LFORMS_MAGIC, the build string and LFORMS_FORMAT is */
+/* followed by the size, mtime and hash of the source, then each form */
+#define LFORMS_MAGIC "LSPC"
+#define LFORMS_FORMAT 2
+#define LFORMS_RACY 0xFFFFFFFFFFFFFFFFULL
+
+/* the built in reader is about as fast as loading a cache that is twice */
+/* the size of the source, so caches are only used with --mpc-reader */
+int lforms_enabled = 1;
+
+int lforms_wanted(void) {
+    return lforms_enabled && lreader_mpc;
+}
+
+unsigned long long lhash_bytes(const unsigned char* data, unsigned long len) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (unsigned long i = 0; i < len; i++) { h = (h ^ data[i]) * 1099511628211ULL; }
+    return h;
+}
+
+void abuf_u64(abuf* b, unsigned long long x) {
+    abuf_u32(b, x & 0xFFFFFFFF);
+    abuf_u32(b, x >> 32);
+}
+
+int limage_u64(limage* m, unsigned long long* x) {
+    unsigned long lo, hi;
+    if (!limage_u32(m, &lo) || !limage_u32(m, &hi)) { return 0; }
+    *x = ((unsigned long long)hi << 32) | lo;
+    return 1;
+}
+
+char* lforms_path(char* path) {
+    char* cpath = malloc(strlen(path)+2);
+    strcpy(cpath, path);
+    strcat(cpath, "c");
+    return cpath;
+}
+
+/* hash of the source, or 0 with "ok" cleared if it cannot be read */
+unsigned long long lforms_hash(char* path, int* ok) {
+    unsigned long len;
+    unsigned char* data = lfile_map(path, &len);
+    *ok = data != NULL;
+    if (!data) { return 0; }
+    unsigned long long h = lhash_bytes(data, len);
+    lfile_unmap(data, len);
+    return h;
+}
+
+/* a cache written alongside a file as its forms are read */
+typedef struct {
+    FILE* f;
+    char* path;
+    char* tmp;
+    abuf b;
+    int failed;
+} lforms_writer;
+
+void lforms_flush(lforms_writer* w) {
+    if (fwrite(w->b.data, 1, w->b.len, w->f) != (size_t)w->b.len) { w->failed = 1; }
+    w->b.len = 0;
+}
+
+/* start the cache of "path", written aside and renamed once complete */
+/* so that other processes never see half a file */
+int lforms_begin(lforms_writer* w, char* path, struct stat* st, unsigned long long hash) {
+    w->path = lforms_path(path);
+    w->tmp = malloc(strlen(w->path)+32);
+    #ifdef LISSP_MMAP
+    sprintf(w->tmp, "%s.%ld", w->path, (long)getpid());
+    #else
+    sprintf(w->tmp, "%s.tmp", w->path);
+    #endif
+    w->f = fopen(w->tmp, "wb");
+    if (!w->f) { free(w->path); free(w->tmp); return 0; }
+    
+    w->b.data = NULL;
+    w->b.len = 0;
+    w->b.size = 0;
+    w->failed = 0;
+    abuf_bytes(&w->b, LFORMS_MAGIC, 4);
+    abuf_bytes(&w->b, lbuild_id(), strlen(lbuild_id())+1);
+    abuf_u32(&w->b, LFORMS_FORMAT);
+    abuf_u64(&w->b, st->st_size);
+    /* an mtime this recent could be shared with a later edit, so the */
+    /* hash is always checked instead, as git does for racy entries */
+    int racy = st->st_mtime >= time(NULL) - 1;
+    abuf_u64(&w->b, racy ? LFORMS_RACY : (unsigned long long)st->st_mtime);
+    abuf_u64(&w->b, hash);
+    lforms_flush(w);
+    return 1;
+}
+
+void lforms_write(lforms_writer* w, lval* x) {
+    if (!lval_save(&w->b, x)) { w->failed = 1; }
+    lforms_flush(w);
+}
+
+/* keep the cache if "keep" is set and it was all written, otherwise remove it */
+void lforms_end(lforms_writer* w, int keep) {
+    keep = keep && !w->failed;
+    if (fclose(w->f) != 0) { keep = 0; }
+    if (keep && rename(w->tmp, w->path) != 0) {
+        remove(w->path);
+        keep = rename(w->tmp, w->path) == 0;
+    }
+    if (!keep) { remove(w->tmp); }
+    free(w->b.data);
+    free(w->tmp);
+    free(w->path);
+}
+
+/* step over one form, returning 0 if the cache is damaged */
+int lforms_skip(limage* m) {
+    if (m->pos >= m->len) { return 0; }
+    char tag = m->data[m->pos++];
+    unsigned long n;
+    switch (tag) {
+        case 'n': return limage_u32(m, &n) && limage_u32(m, &n);
+        case 'e': case 'y': case 's':
+            if (!limage_u32(m, &n) || m->len - m->pos < n) { return 0; }
+            m->pos += n;
+            return 1;
+        case '(': case '{':
+            if (!limage_u32(m, &n)) { return 0; }
+            for (unsigned long i = 0; i < n; i++) { if (!lforms_skip(m)) { return 0; } }
+            return 1;
+    }
+    return 0;
+}
+
+/* pass each form of "path" from its cache to "fn", returning 0 if there */
+/* is no valid cache, in which case nothing has been passed */
+int lforms_load(lenv* e, char* path, struct stat* st, lform_fn fn, void* data) {
+    char* cpath = lforms_path(path);
+    unsigned long len;
+    unsigned char* cache = lfile_map(cpath, &len);
+    free(cpath);
+    if (!cache) { return 0; }
+    
+    limage m = {cache, len, 0};
+    char* id = lbuild_id();
+    unsigned long header = 4 + strlen(id)+1;
+    unsigned long format;
+    unsigned long long size, mtime, hash;
+    int valid = 0, stale = 0;
+    if (len >= header && memcmp(cache, LFORMS_MAGIC, 4) == 0
+        && memcmp(cache+4, id, strlen(id)+1) == 0) {
+        m.pos = header;
+        if (limage_u32(&m, &format) && format == LFORMS_FORMAT
+            && limage_u64(&m, &size) && limage_u64(&m, &mtime) && limage_u64(&m, &hash)
+            && size == (unsigned long long)st->st_size) {
             
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
-            break;
+            /* a changed mtime alone does not mean changed contents */
+            int ok = 1;
+            stale = mtime != (unsigned long long)st->st_mtime;
+            valid = (!stale || lforms_hash(path, &ok) == hash) && ok;
         }
-        
-        /* pop next argument from list */
-        lval* val = lval_pop(a, 0);
-        
-        /* bind copy into function's environment */
-        lenv_put(f->env, sym, val);
-        
-        lval_del(sym); lval_del(val);
     }
-    /* argument list now bound -  free to be clean up */
-    lval_del(a);
     
-    /* if '&' remains bind to empty list */
-    if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    /* the whole cache is checked first, as evaluated forms cannot be undone */
+    unsigned long forms = m.pos;
+    while (valid && m.pos < m.len) { valid = lforms_skip(&m); }
+    if (!valid) { lfile_unmap(cache, len); return 0; }
+    
+    if (stale) {
+        lforms_writer w;
+        if (lforms_begin(&w, path, st, hash)) {
+            if (fwrite(cache + forms, 1, len - forms, w.f) != len - forms) { w.failed = 1; }
+            lforms_end(&w, 1);
+        }
+    }
+    
+    for (m.pos = forms; m.pos < m.len;) { fn(e, limage_lval(&m, NULL), data); }
+    lfile_unmap(cache, len);
+    return 1;
+}
+
+int lforms_delim(char c) {
+    return isspace((unsigned char)c) || c == '(' || c == ')' || c == '{' || c == '}'
+        || c == '"' || c == ';' || c == '\0';
+}
+
+/* where the top-level form starting at "s" ends, following brackets, */
+/* strings and comments just far enough to find it */
+const char* lforms_next(const char* s, const char* end) {
+    int depth = 0;
+    do {
+        switch (*s) {
+            case '(': case '{': depth++; s++; break;
+            case ')': case '}': depth--; s++; break;
+            case '"':
+                for (s++; s < end && *s != '"'; s++) { if (*s == '\\' && s+1 < end) { s++; } }
+                if (s < end) { s++; }
+                break;
+            case ';':
+                while (s < end && *s != '\n' && *s != '\r') { s++; }
+                break;
+            default:
+                if (lforms_delim(*s)) { s++; break; }
+                while (s < end && !lforms_delim(*s)) { s++; }
+        }
+    } while (s < end && depth > 0);
+    return s;
+}
+
+/* read a file one top-level form at a time, passing each to "fn" as soon */
+/* as it is read, so only the largest form is ever held in memory */
+lval* lenv_load_file(lenv* e, char* path, lform_fn fn, void* data) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return lval_err("Could not load library %s: error: Unable to open file!\n", path);
+    }
+    if (lforms_wanted() && lforms_load(e, path, &st, fn, data)) { return lval_sexpr(); }
+    
+    unsigned long len = 0;
+    const char* text = st.st_size ? (const char*)lfile_map(path, &len) : NULL;
+    if (st.st_size && !text) {
+        return lval_err("Could not load library %s: error: Unable to open file!\n", path);
+    }
+    
+    lforms_writer w;
+    int cache = lforms_wanted() && text && lforms_begin(&w, path, &st, lhash_bytes((const unsigned char*)text, len));
+    
+    lval* result = lval_sexpr();
+    if (!lreader_mpc) {
+        lreader r = {text, text, text + len, path, NULL};
+        lval* x;
+        while ((x = lreader_form(&r))) {
+            if (cache) { lforms_write(&w, x); }
+            fn(e, x, data);
+        }
+        if (r.err) {
+            lval_del(result);
+            result = lval_err("Could not load library %s", r.err->err);
+            lval_del(r.err);
+        }
+    } else {
+        const char* s = text;
+        const char* end = text + len;
+        while (s < end) {
+            if (isspace((unsigned char)*s)) { s++; continue; }
+            if (*s == ';') { while (s < end && *s != '\n' && *s != '\r') { s++; } continue; }
             
-            if (f->formals->count != 2) {
-                return lval_err("Function format invalid."
-                    "Symbol '&' not followed by single symbol.");
+            /* each form is parsed in place, by the grammar for a whole file */
+            const char* next = lforms_next(s, end);
+            mpc_result_t r;
+            if (!lreader_mpc_parse(path, s, next - s, &r)) {
+                /* errors are placed within the file rather than within the form */
+                int row = 0, col = 0;
+                for (const char* c = text; c < s; c++) {
+                    if (*c == '\n') { row++; col = 0; } else { col++; }
+                }
+                if (r.error->state.row == 0) { r.error->state.col += col; }
+                r.error->state.row += row;
+            
+                char* err_msg = mpc_err_string(r.error);
+                mpc_err_delete(r.error);
+                lval_del(result);
+                result = lval_err("Could not load library %s", err_msg);
+                free(err_msg);
+                break;
             }
-            lval_del(lval_pop(f->formals, 0));
             
-            lval* sym = lval_pop(f->formals, 0);
-            lval* val = lval_qexpr();
+            lval* forms = lval_read(r.output);
+            mpc_ast_delete(r.output);
+            while (forms->count) {
+                lval* x = lval_pop(forms, 0);
+                if (cache) { lforms_write(&w, x); }
+                fn(e, x, data);
+            }
+            lval_del(forms);
+            s = next;
+        }
+    }
+    
+    if (cache) { lforms_end(&w, result->type != LVAL_ERR); }
+    if (text) { lfile_unmap((unsigned char*)text, len); }
+    return result;
+}
+
+/* time reading every form of "path" without evaluating any, for --bench-read */
+lval* lreader_bench(char* path) {
+    unsigned long len;
+    const char* text = (const char*)lfile_map(path, &len);
+    if (!text) { return lval_err("Could not open %s", path); }
+    
+    /* with mpc, the first quarter, half and then all of the forms are */
+    /* parsed as one string, which should take time in proportion */
+    if (lreader_mpc) {
+        const char* s = text;
+        const char* end = text + len;
+        lval* err = NULL;
+        for (int part = 1; part <= 4 && !err; part *= 2) {
+            while (s < end && (unsigned long)(s - text) < len / 4 * part) {
+                while (s < end && isspace((unsigned char)*s)) { s++; }
+                if (s < end) { s = lforms_next(s, end); }
+            }
+            /* the memo counts each run on its own */
+            mpc_memo_t* m = &lreader_memo;
+            m->peak = 0;
+            m->lookups = m->hits = m->stored = m->dropped = 0;
             
-            lenv_put(f->env, sym, val);
-            lval_del(sym); lval_del(val);
+            clock_t start = clock();
+            mpc_result_t r;
+            if (lreader_mpc_parse(path, text, s - text, &r)) {
+                mpc_ast_delete(r.output);
+            } else {
+                char* err_msg = mpc_err_string(r.error);
+                mpc_err_delete(r.error);
+                err = lval_err("%s", err_msg);
+                free(err_msg);
+            }
+            double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+            if (!err) {
+                printf("mpc    read %.1f MB in %.3fs, %.1f MB/s\n",
+                    (s - text) / 1e6, secs, secs > 0 ? (s - text) / 1e6 / secs : 0.0);
+            }
+            if (!err && lreader_packrat) {
+                printf("memo   %ld lookups, %.1f%% hit, %ld stored, %ld dropped, %.1f MB peak\n",
+                    m->lookups, m->lookups ? 100.0 * m->hits / m->lookups : 0.0,
+                    m->stored, m->dropped, m->peak / 1e6);
+            }
+        }
+        lfile_unmap((unsigned char*)text, len);
+        return err ? err : lval_sexpr();
     }
     
-    /* if all formals bound - evaluate */
-    if (f->formals->count == 0) {
-        /* set env parent to evaluation env */
-        f->env->par = e;
+    /* once with each way of scanning this CPU supports */
+    lscan best = lreader_scan;
+    lval* err = NULL;
+    for (int i = 0; i < lscan_count && !err; i++) {
+        lreader_scan = lscan_levels[i];
+        clock_t start = clock();
+        lreader r = {text, text, text + len, path, NULL};
+        long forms = 0;
+        lval* x;
+        while ((x = lreader_form(&r))) { forms++; lval_del(x); }
+        double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
         
-        return builtin_eval(
-            f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        /* return partially evaluated function */
-        return lval_copy(f);
+        err = r.err;
+        if (!err) {
+            printf("%-6s read %ld forms, %.1f MB in %.3fs, %.1f MB/s\n", lreader_scan.name,
+                forms, len / 1e6, secs, secs > 0 ? len / 1e6 / secs : 0.0);
+        }
     }
+    lreader_scan = best;
+    
+    lfile_unmap((unsigned char*)text, len);
+    return err ? err : lval_sexpr();
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+/* a pipe read one character at a time, keeping the position reached */
+typedef struct {
+    FILE* f;
+    int row, col;
+    int last_row, last_col;
+    int form_row, form_col; /* where the last form read started */
+} lpipe;
 
-    for (int i = 0; i < v->count; i++) { v->cell[i] = lval_eval(e, v->cell[i]); }
-    for (int i = 0; i < v->count; i++) { if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); } }
-    
-    if (v->count == 0) { return v; }
-    if (v->count == 1) { return lval_take(v, 0); }
+int lpipe_getc(lpipe* p) {
+    p->last_row = p->row;
+    p->last_col = p->col;
+    int c = getc(p->f);
+    if (c == '\n') { p->row++; p->col = 0; } else if (c != EOF) { p->col++; }
+    return c;
+}
+
+void lpipe_ungetc(lpipe* p, int c) {
+    if (c == EOF) { return; }
+    ungetc(c, p->f);
+    p->row = p->last_row;
+    p->col = p->last_col;
+}
+
+void lpipe_put(abuf* b, int c) {
+    char ch = c;
+    abuf_bytes(b, &ch, 1);
+}
+
+/* append the next top-level form of "p" to "b", following brackets, strings */
+/* and comments as lforms_next does, but never reading past the end of the */
+/* form, so that it is complete without waiting for more input */
+int lpipe_form(lpipe* p, abuf* b) {
+    int c;
+    do { c = lpipe_getc(p); } while (c != EOF && isspace(c));
+    if (c == EOF) { return 0; }
+    p->form_row = p->last_row;
+    p->form_col = p->last_col;
     
-    /* ensure first element is function after evaluation */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval* err = lval_err(
-            "S-Expression starts with incorrect type. Got %s, expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
-        lval_del(f); lval_del(v);
-        return err;
+    int depth = 0;
+    do {
+        switch (c) {
+            case '(': case '{': depth++; lpipe_put(b, c); break;
+            case ')': case '}': depth--; lpipe_put(b, c); break;
+            case '"':
+                lpipe_put(b, c);
+                while ((c = lpipe_getc(p)) != EOF) {
+                    lpipe_put(b, c);
+                    if (c == '"') { break; }
+                    if (c == '\\' && (c = lpipe_getc(p)) != EOF) { lpipe_put(b, c); }
+                }
+                break;
+            case ';':
+                while (c != EOF && c != '\n' && c != '\r') { lpipe_put(b, c); c = lpipe_getc(p); }
+                lpipe_ungetc(p, c);
+                break;
+            default:
+                lpipe_put(b, c);
+                if (lforms_delim(c)) { break; }
+                while ((c = lpipe_getc(p)) != EOF && !lforms_delim(c)) { lpipe_put(b, c); }
+                lpipe_ungetc(p, c);
+        }
+    } while (depth > 0 && (c = lpipe_getc(p)) != EOF);
+    return 1;
+}
+
+/* evaluate the forms of a pipe one at a time, as each is read, */
+/* setting "failed" when one of them evaluates to an error */
+lval* lval_load_pipe(lenv* e, char* name, FILE* f, int* failed) {
+    lpipe p = {f, 0, 0, 0, 0, 0, 0};
+    abuf b = {NULL, 0, 0};
+    lval* result = lval_sexpr();
+    while (1) {
+        b.len = 0;
+        if (!lpipe_form(&p, &b)) { break; }
+        
+        mpc_result_t r;
+        if (!lreader_mpc_parse(name, b.data, b.len, &r)) {
+            /* errors are placed within the pipe rather than within the form */
+            if (r.error->state.row == 0) { r.error->state.col += p.form_col; }
+            r.error->state.row += p.form_row;
+            
+            char* err_msg = mpc_err_string(r.error);
+            mpc_err_delete(r.error);
+            lval_del(result);
+            result = lval_err("Could not load library %s", err_msg);
+            free(err_msg);
+            break;
+        }
+        
+        lval* forms = lval_read(r.output);
+        mpc_ast_delete(r.output);
+        while (forms->count) {
+            lval* x = lval_eval(e, lval_pop(forms, 0));
+            if (x->type == LVAL_ERR) { lval_println(x); *failed = 1; }
+            lval_del(x);
+        }
+        lval_del(forms);
+        fflush(stdout);
     }
-    /* if so call function to get result */
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
+    free(b.data);
     return result;
 }
 
-lval* lval_eval(lenv* e, lval* v) {
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+/* whether "x" is "(fun {name args} {body})" and can wait until name is used */
+/* 'fun' and the builtins it calls must still be the prelude's own */
+int lenv_deferrable(lenv* e, lval* x, lval* fun) {
+    if (x->type != LVAL_SEXPR || x->count != 3) { return 0; }
+    if (x->cell[0]->type != LVAL_SYM || strcmp(x->cell[0]->sym, "fun") != 0) { return 0; }
+    if (x->cell[1]->type != LVAL_QEXPR || x->cell[1]->count == 0) { return 0; }
+    if (x->cell[2]->type != LVAL_QEXPR) { return 0; }
+    for (int i = 0; i < x->cell[1]->count; i++) {
+        if (x->cell[1]->cell[i]->type != LVAL_SYM) { return 0; }
     }
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-    return v;
-}        
+    
+    /* a redefinition is evaluated in order, replacing the earlier one */
+    if (lenv_local(e, x->cell[1]->cell[0]) || lenv_force(e, x->cell[1]->cell[0])) { return 0; }
+    
+    lval* f = lenv_local(e, x->cell[0]);
+    if (!f || f->type != LVAL_FUN || f->builtin || f->env->count
+        || !lval_eq(f->formals, fun->cell[1]) || !lval_eq(f->body, fun->cell[2])) { return 0; }
+    
+    char* uses[] = { "def", "head", "tail", "\\" };
+    for (int i = 0; i < 4; i++) {
+        lval* k = lval_sym(uses[i]);
+        lval* b = lenv_local(e, k);
+        lval_del(k);
+        if (!b || !b->builtin || strcmp(lbuiltin_name(b->builtin), uses[i]) != 0) { return 0; }
+    }
+    return 1;
+}
+
+void lform_lazy(lenv* e, lval* x, void* data) {
+    if (data && lenv_deferrable(e, x, data)) { lenv_defer(e, x); return; }
+    lform_eval(e, x, NULL);
+}
+
+/* load the prelude, leaving function definitions until they are first used */
+lval* lenv_load_lazy(lenv* e, char* path) {
+    /* the definition of 'fun' that deferred forms stand in for */
+    lval* fun = lval_read_string("fun", "\\ {f b} {def (head f) (\\ (tail f) b)}");
+    
+    lval* x = lenv_load_file(e, path, lform_lazy, fun);
+    if (fun) { lval_del(fun); }
+    return x;
+}
+
+/* prelude.lssp is looked for next to the executable before the current */
+/* directory, unless -DLISSP_PRELUDE_PATH gives where it is installed */
+char* lprelude_path(char* argv0) {
+    char* name = "prelude.lssp";
+    #ifdef LISSP_PRELUDE_PATH
+    name = LISSP_PRELUDE_PATH;
+    #else
+    char exe[4096];
+    long n = -1;
+    #ifdef __linux__
+    n = readlink("/proc/self/exe", exe, sizeof(exe)-1);
+    #endif
+    if (n < 0 && argv0 && strlen(argv0) < sizeof(exe)) { n = strlen(argv0); memcpy(exe, argv0, n); }
+    
+    while (n > 0 && exe[n-1] != '/' && exe[n-1] != '\\') { n--; }
+    if (n > 0 && n + strlen(name) < sizeof(exe)) {
+        struct stat st;
+        strcpy(exe + n, name);
+        if (stat(exe, &st) == 0) { name = exe; }
+    }
+    #endif
+    char* path = malloc(strlen(name)+1);
+    strcpy(path, name);
+    return path;
+}
+
+/* the prelude as an image, made with --emit-prelude */
+#ifdef LISSP_PRELUDE
+#include LISSP_PRELUDE
+#endif
+
+/* functions compiled from Lissp with --emit-c */
+#ifdef LISSP_AOT
+#include LISSP_AOT
+#endif
+
+void lstats_print(void) {
+    unsigned long lookups = lcache_hits + lcache_misses;
+    fprintf(stderr, "Inline cache: %lu hits, %lu misses (%.1f%% hit rate)\n",
+        lcache_hits, lcache_misses, lookups ? 100.0 * lcache_hits / lookups : 0.0);
+    if (ljit_enabled) {
+        fprintf(stderr, "JIT: %lu compiled, %lu native calls, %lu bails\n",
+            ljit_compiled, ljit_runs, ljit_bails);
+    }
+}
 
 int main(int argc, char* argv[]) {
 
+    /* options come before any files to load */
+    int stats = 0;
+    char* emit = NULL;
+    char* bench = NULL;
+    char* image = NULL;
+    int emit_prelude = 0;
+    int eager = 0;
+    int first = 1;
+    while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+        if (strcmp(argv[first], "--check") == 0) {
+            /* check new global functions as they are defined */
+            lcheck_enabled = 1;
+        } else if (strcmp(argv[first], "--jit") == 0) {
+            /* compile hot numeric lambdas to native code */
+            #ifdef LISSP_JIT
+            ljit_enabled = 1;
+            #else
+            fprintf(stderr, "The JIT is not available on this platform\n");
+            #endif
+        } else if (strcmp(argv[first], "--emit-c") == 0 && first+1 < argc) {
+            /* translate a file to C instead of running anything */
+            emit = argv[++first];
+        } else if (strcmp(argv[first], "--image") == 0 && first+1 < argc) {
+            /* start from an image made by 'save-image' instead of the prelude */
+            image = argv[++first];
+        } else if (strcmp(argv[first], "--emit-prelude") == 0) {
+            /* print the prelude as an image to build into the binary */
+            emit_prelude = 1;
+        } else if (strcmp(argv[first], "--eager") == 0) {
+            /* evaluate every prelude definition at startup */
+            eager = 1;
+        } else if (strcmp(argv[first], "--bench-read") == 0 && first+1 < argc) {
+            /* report how fast a file is read, without running anything */
+            bench = argv[++first];
+        } else if (strcmp(argv[first], "--mpc-reader") == 0) {
+            /* read source with the mpc grammar rather than the built in reader */
+            lreader_mpc = 1;
+        } else if (strcmp(argv[first], "--packrat") == 0) {
+            /* let the mpc grammar replay rules rather than parse again */
+            lreader_packrat = 1;
+        } else if (strcmp(argv[first], "--no-cache") == 0) {
+            /* always parse files rather than using their .lsspc caches */
+            lforms_enabled = 0;
+        } else if (strcmp(argv[first], "--stats") == 0) {
+            /* report interpreter statistics once all files are loaded */
+            stats = 1;
+        } else {
+            fprintf(stderr, "Unknown option '%s'\n", argv[first]);
+            return 1;
+        }
+        first++;
+    }
+
     /* Create parsers */
     Number   = mpc_new("number");
     Symbol   = mpc_new("symbol");
@@ -981,18 +4640,78 @@ int main(int argc, char* argv[]) {
         ",
 	Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lissp);
 
+    lreader_init();
+    if (bench) {
+        lval* x = lreader_bench(bench);
+        int failed = x->type == LVAL_ERR;
+        if (failed) { lval_println(x); }
+        lval_del(x);
+        mpc_cleanup(8, Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Lissp);
+        return failed;
+    }
+    
     lenv* e = lenv_new();
     lenv_add_builtins(e);
 
-    lval* args = lval_add(lval_sexpr(), lval_str("prelude.lssp"));
-    lval* x = builtin_load(e, args);
-    if (x->type == LVAL_ERR) { lval_println(x); }
-    lval_del(x);
+    /* a built in prelude needs no reading, parsing or evaluating */
+    int prelude = 0;
+    if (image) {
+        lval* x = limage_load_file(e, image);
+        prelude = x->type != LVAL_ERR;
+        if (!prelude) { lval_println(x); }
+        lval_del(x);
+    }
+    #ifdef LISSP_PRELUDE
+    if (!prelude && !emit_prelude) {
+        lval* x = limage_load(e, lissp_prelude, sizeof(lissp_prelude));
+        prelude = x->type != LVAL_ERR;
+        if (!prelude) { lval_println(x); }
+        lval_del(x);
+    }
+    #endif
+    
+    /* checked definitions report their errors as the prelude loads */
+    if (!prelude) {
+        char* path = lprelude_path(argv[0]);
+        lval* x;
+        if (!eager && !lcheck_enabled) {
+            x = lenv_load_lazy(e, path);
+        } else {
+            x = builtin_load(e, lval_add(lval_sexpr(), lval_str(path)));
+        }
+        if (x->type == LVAL_ERR) { lval_println(x); }
+        lval_del(x);
+        free(path);
+    }
+    
+    if (emit_prelude) {
+        lval* x = limage_emit(e, stdout);
+        int failed = x->type == LVAL_ERR;
+        if (failed) { lval_println(x); }
+        lval_del(x);
+        lenv_del(e);
+        mpc_cleanup(8, Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Lissp);
+        return failed;
+    }
+    
+    #ifdef LISSP_AOT
+    lenv_add_aot(e);
+    #endif
+    
+    if (emit) {
+        lval* x = aot_emit(e, emit, stdout);
+        int failed = x->type == LVAL_ERR;
+        if (failed) { lval_println(x); }
+        lval_del(x);
+        lenv_del(e);
+        mpc_cleanup(8, Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Lissp);
+        return failed;
+    }
 
 
-    if (argc == 1) {
+    if (first == argc) {
         /* Print version and exit information */
-        puts("Lissp Version 0.0.0.1.0");
+        printf("Lissp Version %s\n", lbuild_id());
         puts("Press CTRL+C to exit\n");
     
         while (1) {
@@ -1000,39 +4719,54 @@ int main(int argc, char* argv[]) {
             char* input = readline("lissp> ");
             add_history(input);
 
-            mpc_result_t r;
-            if (mpc_parse("<stdin>", input, Lissp, &r)) {
-
-                /* on success, print the evaluated output */
-                lval* x = lval_eval(e, lval_read(r.output));
+            /* on success, print the evaluated output */
+            lval* v = lval_read_string("<stdin>", input);
+            if (v) {
+                lval* x = lval_eval(e, v);
                 lval_println(x);
                 lval_del(x);
-
-            } else {
-                /* Otherwise, print the error */
-                mpc_err_print(r.error);
-                mpc_err_delete(r.error);
             }
             free(input);
         }
     }
     
-    if (argc >= 2) {
-        /* loop over each filename starting from 1 */
-        for (int i = 1; i < argc; i++) {
+    /* an expression or file that fails makes the exit status non-zero */
+    int failed = 0;
+    if (first < argc) {
+        /* loop over each filename following the options */
+        for (int i = first; i < argc; i++) {
             
-            lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
-            lval* x = builtin_load(e, args);
+            if (strcmp(argv[i], "-e") == 0 && i+1 < argc) {
+                /* evaluate an expression as if typed at the prompt */
+                lval* v = lval_read_string("<-e>", argv[++i]);
+                if (!v) { failed = 1; continue; }
+                lval* x = lval_eval(e, v);
+                if (x->type == LVAL_ERR) { failed = 1; }
+                lval_println(x);
+                lval_del(x);
+                continue;
+            }
+            
+            /* "-" reads a program from stdin, running each form as it arrives */
+            lval* x;
+            if (strcmp(argv[i], "-") == 0) {
+                x = lval_load_pipe(e, "<stdin>", stdin, &failed);
+            } else {
+                lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
+                x = builtin_load(e, args);
+            }
             
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (x->type == LVAL_ERR) { lval_println(x); failed = 1; }
             lval_del(x);
         }
     }
+    
+    if (stats) { lstats_print(); }
         
     lenv_del(e); 
     
     /* Undefine and delete parsers */
     mpc_cleanup(8, Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Lissp);
     
-    return 0;
+    return failed;
 }
@@ -1,5 +1,25 @@
+/* mapping input files and locking need more than C89 provides */
+#ifndef _WIN32
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#define MPC_MMAP
+#define MPC_THREADS
+#endif
+
 #include "mpc.h"
 
+#ifdef MPC_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef MPC_THREADS
+#include <pthread.h>
+#endif
+
 /*
 ** State Type
 */
@@ -122,13 +142,14 @@ void mpc_err_string_cat(char *buffer, int *pos, int *max, char *fmt, ...) {
   va_end(va);
 }
 
-static char char_unescape_buffer[3];
+static char char_unescape_buffer[4];
 
 static char *mpc_err_char_unescape(char c) {
   
   char_unescape_buffer[0] = '\'';
   char_unescape_buffer[1] = ' ';
   char_unescape_buffer[2] = '\'';
+  char_unescape_buffer[3] = '\0';
   
   switch (c) {
     
@@ -307,6 +328,13 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
 **
 */
 
+enum {
+  MPC_INPUT_BUFFER_KEEP = 4096
+};
+
+struct mpc_packrat_t;
+typedef struct mpc_packrat_t mpc_packrat_t;
+
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
@@ -319,20 +347,36 @@ typedef struct {
   char *filename;  
   mpc_state_t state;
   
-  char *string;
+  const char *string;
+  size_t length;
   char *buffer;
+  size_t buffer_len;
+  size_t buffer_cap;
   FILE *file;
   
   int backtrack;
   int marks_num;
+  int marks_slots;
   mpc_state_t* marks;
   char* lasts;
   
   char last;
   
+  mpc_packrat_t *memo;
+  
+  int exact;
+  int dfa_used;
+  
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+/*
+** String input borrows the caller's buffer, which
+** must outlive the parse, and knows its length so
+** that the end is found without scanning for it
+** and may contain NUL characters.
+*/
+
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string, size_t length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -342,17 +386,23 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = length;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
   i->file = NULL;
   
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_slots = 0;
   i->marks = NULL;
   i->lasts = NULL;
 
   i->last = '\0';
+  i->memo = NULL;
+  i->exact = 0;
+  i->dfa_used = 0;
   
   return i;
 }
@@ -368,15 +418,22 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
   i->file = pipe;
   
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_slots = 0;
   i->marks = NULL;
   i->lasts = NULL;
   
   i->last = '\0';
+  i->memo = NULL;
+  i->exact = 0;
+  i->dfa_used = 0;
   
   return i;
   
@@ -392,15 +449,22 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
   i->file = file;
   
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_slots = 0;
   i->marks = NULL;
   i->lasts = NULL;
   
   i->last = '\0';
+  i->memo = NULL;
+  i->exact = 0;
+  i->dfa_used = 0;
   
   return i;
 }
@@ -408,9 +472,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
 static void mpc_input_delete(mpc_input_t *i) {
   
   free(i->filename);
-  
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  free(i->buffer);
   
   free(i->marks);
   free(i->lasts);
@@ -425,13 +487,16 @@ static void mpc_input_mark(mpc_input_t *i) {
   if (i->backtrack < 1) { return; }
   
   i->marks_num++;
-  i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-  i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
+  if (i->marks_num > i->marks_slots) {
+    i->marks_slots = i->marks_slots ? i->marks_slots * 2 : 32;
+    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
+    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
+  }
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
+    i->buffer_len = 0;
   }
   
 }
@@ -441,12 +506,14 @@ static void mpc_input_unmark(mpc_input_t *i) {
   if (i->backtrack < 1) { return; }
   
   i->marks_num--;
-  i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-  i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+    i->buffer_len = 0;
+    if (i->buffer_cap > MPC_INPUT_BUFFER_KEEP) {
+      free(i->buffer);
+      i->buffer = NULL;
+      i->buffer_cap = 0;
+    }
   }
   
 }
@@ -465,18 +532,34 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
+/*
+** While a mark is held on a pipe the characters
+** read since the outermost mark are kept in a
+** buffer starting at that mark's position, so
+** they can be read again after a rewind.
+*/
+
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (strlen(i->buffer) + i->marks[0].pos);
+  return i->marks_num > 0
+    && (size_t)(i->state.pos - i->marks[0].pos) < i->buffer_len;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
   return i->buffer[i->state.pos - i->marks[0].pos];
 }
 
+static void mpc_input_buffer_push(mpc_input_t *i, char c) {
+  if (i->buffer_len == i->buffer_cap) {
+    i->buffer_cap = i->buffer_cap ? i->buffer_cap * 2 : 64;
+    i->buffer = realloc(i->buffer, i->buffer_cap);
+  }
+  i->buffer[i->buffer_len++] = c;
+}
+
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && (size_t)i->state.pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && !mpc_input_buffer_in_range(i) && feof(i->file)) { return 1; }
   return 0;
 }
 
@@ -486,13 +569,11 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         c = mpc_input_buffer_get(i);
         return c;
       } else {
@@ -509,7 +590,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -520,14 +601,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
     
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         return mpc_input_buffer_get(i);
       } else {
         c = getc(i->file);
@@ -548,9 +622,7 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); break;
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         break;
       } else {
         ungetc(c, i->file); 
@@ -564,12 +636,9 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
   if (i->type == MPC_INPUT_PIPE &&
-      i->buffer &&
+      i->marks_num > 0 &&
       !mpc_input_buffer_in_range(i)) {
-    
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
+    mpc_input_buffer_push(i, c);
   }
   
   i->last = c;
@@ -608,16 +677,18 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
-  char x = mpc_input_getc(i);
-  if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
-}
+/*
+** Character classes are sets of all 256 characters
+** held as bits, built once with their parser, so
+** that matching one is a single test of a bit.
+*/
+
+#define mpc_set_has(bits, c) ((bits)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_set(mpc_input_t *i, const unsigned char *bits, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return mpc_set_has(bits, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -684,7 +755,9 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_DFA       = 25
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -695,6 +768,7 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; unsigned char bits[32]; } mpc_pdata_set_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
@@ -702,6 +776,7 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; int n; int *table; } mpc_pdata_dfa_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -712,6 +787,7 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_set_t set;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
@@ -719,6 +795,7 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -728,10 +805,53 @@ struct mpc_parser_t {
   mpc_pdata_t data;
 };
 
+/*
+** Lazy Errors
+**
+** Most errors made while parsing are thrown away
+** as soon as another alternative succeeds. So in
+** the parser they are only small records of where
+** and why, taken from a pool, which point at the
+** messages held by the parsers. Only when a parse
+** fails overall are they built into an `mpc_err_t`.
+**
+** Merging keeps only the errors furthest into the
+** input, as `mpc_err_or` would, so the records in
+** use stay few however long the parse runs, and
+** usually fit in the stack without allocating.
+*/
+
+enum {
+  MPC_LERR_FAIL   = 0,
+  MPC_LERR_EXPECT = 1,
+  MPC_LERR_REPEAT = 2,
+  MPC_LERR_OR     = 3
+};
+
+enum {
+  MPC_LERR_FIRST = 64,
+  MPC_LERR_BLOCK = 256
+};
+
+typedef struct mpc_lerr_t {
+  mpc_state_t state;
+  char type;
+  char recieved;
+  int n;
+  const char *m;
+  struct mpc_lerr_t *x;
+  struct mpc_lerr_t *next;
+} mpc_lerr_t;
+
 /*
 ** Stack Type
 */
 
+typedef union {
+  mpc_lerr_t *error;
+  mpc_val_t *output;
+} mpc_stack_result_t;
+
 typedef struct {
 
   int parsers_num;
@@ -741,15 +861,178 @@ typedef struct {
 
   int results_num;
   int results_slots;
-  mpc_result_t *results;
+  mpc_stack_result_t *results;
   int *returns;
   
-  mpc_err_t *err;
+  const char *filename;
+  mpc_lerr_t *err;
+  
+  mpc_lerr_t *spare;
+  int first_num;
+  mpc_lerr_t first[MPC_LERR_FIRST];
+  int blocks_num;
+  int blocks_used;
+  int block_next;
+  mpc_lerr_t **blocks;
   
 } mpc_stack_t;
 
-static mpc_stack_t *mpc_stack_new(const char *filename) {
-  mpc_stack_t *s = malloc(sizeof(mpc_stack_t));
+static mpc_lerr_t *mpc_lerr_alloc(mpc_stack_t *s) {
+  
+  mpc_lerr_t *x;
+  
+  if (s->spare) {
+    x = s->spare;
+    s->spare = x->next;
+  } else if (s->first_num < MPC_LERR_FIRST) {
+    x = &s->first[s->first_num++];
+  } else {
+    if (s->blocks_used == 0 || s->block_next == MPC_LERR_BLOCK) {
+      if (s->blocks_used == s->blocks_num) {
+        s->blocks_num++;
+        s->blocks = realloc(s->blocks, sizeof(mpc_lerr_t*) * s->blocks_num);
+        s->blocks[s->blocks_num-1] = malloc(sizeof(mpc_lerr_t) * MPC_LERR_BLOCK);
+      }
+      s->blocks_used++;
+      s->block_next = 0;
+    }
+    x = &s->blocks[s->blocks_used-1][s->block_next++];
+  }
+  
+  x->x = NULL;
+  x->next = NULL;
+  return x;
+}
+
+static void mpc_lerr_delete(mpc_stack_t *s, mpc_lerr_t *x) {
+  mpc_lerr_t *y;
+  while (x) {
+    y = x->next;
+    if (x->x) { mpc_lerr_delete(s, x->x); }
+    x->next = s->spare;
+    s->spare = x;
+    x = y;
+  }
+}
+
+static mpc_lerr_t *mpc_lerr_fail(mpc_stack_t *s, mpc_state_t state, const char *failure) {
+  mpc_lerr_t *x = mpc_lerr_alloc(s);
+  x->state = state;
+  x->type = MPC_LERR_FAIL;
+  x->recieved = ' ';
+  x->m = failure;
+  return x;
+}
+
+static mpc_lerr_t *mpc_lerr_new(mpc_stack_t *s, mpc_state_t state, const char *expected, char recieved) {
+  mpc_lerr_t *x = mpc_lerr_alloc(s);
+  x->state = state;
+  x->type = MPC_LERR_EXPECT;
+  x->recieved = recieved;
+  x->m = expected;
+  return x;
+}
+
+/* `n` is the count for `mpc_count`, or -1 for `mpc_many1` */
+
+static mpc_lerr_t *mpc_lerr_repeat(mpc_stack_t *s, mpc_lerr_t *e, int n) {
+  mpc_lerr_t *x = mpc_lerr_alloc(s);
+  x->state = e->state;
+  x->type = MPC_LERR_REPEAT;
+  x->n = n;
+  x->x = e;
+  return x;
+}
+
+static int mpc_lerr_adds(mpc_lerr_t *x, mpc_lerr_t *y) {
+  
+  /* nothing after a failure is looked at */
+  if (x->type == MPC_LERR_FAIL) { return 0; }
+  
+  /* and the same expectation adds nothing */
+  return !(x->type == MPC_LERR_EXPECT && y->type == MPC_LERR_EXPECT && x->m == y->m);
+}
+
+static mpc_lerr_t *mpc_lerr_or(mpc_stack_t *s, mpc_lerr_t *a, mpc_lerr_t *b) {
+  
+  mpc_lerr_t *x, *y, *next, *last;
+  
+  if (b->state.pos < a->state.pos) { mpc_lerr_delete(s, b); return a; }
+  if (a->state.pos < b->state.pos) { mpc_lerr_delete(s, a); return b; }
+  
+  if (a->type != MPC_LERR_OR) {
+    x = mpc_lerr_alloc(s);
+    x->state = a->state;
+    x->type = MPC_LERR_OR;
+    x->x = a;
+    a = x;
+  }
+  
+  y = b->type == MPC_LERR_OR ? b->x : b;
+  if (b->type == MPC_LERR_OR) { b->x = NULL; mpc_lerr_delete(s, b); }
+  
+  /* children are appended unless they could not change the result */
+  for (; y; y = next) {
+    next = y->next;
+    y->next = NULL;
+    for (x = a->x, last = NULL; x; last = x, x = x->next) {
+      if (!mpc_lerr_adds(x, y)) { break; }
+    }
+    if (x) { mpc_lerr_delete(s, y); } else { last->next = y; }
+  }
+  
+  return a;
+}
+
+static mpc_lerr_t *mpc_lerr_copy(mpc_stack_t *s, mpc_lerr_t *x) {
+  mpc_lerr_t *y = mpc_lerr_alloc(s);
+  *y = *x;
+  y->x = x->x ? mpc_lerr_copy(s, x->x) : NULL;
+  y->next = x->next ? mpc_lerr_copy(s, x->next) : NULL;
+  return y;
+}
+
+static int mpc_lerr_count(mpc_lerr_t *x) {
+  int n = 0;
+  for (; x; x = x->next) { n += 1 + mpc_lerr_count(x->x); }
+  return n;
+}
+
+static mpc_err_t *mpc_lerr_build(const char *filename, mpc_lerr_t *x) {
+  
+  mpc_lerr_t *y;
+  mpc_err_t **es, *e;
+  int n = 0;
+  
+  switch (x->type) {
+    case MPC_LERR_FAIL:   return mpc_err_fail(filename, x->state, x->m);
+    case MPC_LERR_EXPECT: return mpc_err_new(filename, x->state, x->m, x->recieved);
+    case MPC_LERR_REPEAT:
+      e = mpc_lerr_build(filename, x->x);
+      return x->n < 0 ? mpc_err_many1(e) : mpc_err_count(e, x->n);
+    case MPC_LERR_OR:
+      /* An or always holds at least one error */
+      e = mpc_lerr_build(filename, x->x);
+      if (!x->x->next) { return mpc_err_or(&e, 1); }
+      for (y = x->x; y; y = y->next) { n++; }
+      es = malloc(sizeof(mpc_err_t*) * n);
+      es[0] = e;
+      for (y = x->x->next, n = 1; y; y = y->next) { es[n++] = mpc_lerr_build(filename, y); }
+      e = mpc_err_or(es, n);
+      free(es);
+      return e;
+  }
+  
+  return NULL;
+}
+
+/*
+** The stacks only ever grow, so that a stack kept
+** in a context can be reset and used for parse
+** after parse without allocating again.
+*/
+
+static void mpc_stack_init(mpc_stack_t *s) {
   
   s->parsers_num = 0;
   s->parsers_slots = 0;
@@ -761,16 +1044,43 @@ static mpc_stack_t *mpc_stack_new(const char *filename) {
   s->results = NULL;
   s->returns = NULL;
   
-  s->err = mpc_err_fail(filename, mpc_state_invalid(), "Unknown Error");
+  s->filename = NULL;
+  s->err = NULL;
   
-  return s;
+  s->spare = NULL;
+  s->first_num = 0;
+  s->blocks_num = 0;
+  s->blocks_used = 0;
+  s->block_next = 0;
+  s->blocks = NULL;
+}
+
+static void mpc_stack_reset(mpc_stack_t *s, const char *filename) {
+  
+  s->parsers_num = 0;
+  s->results_num = 0;
+  
+  s->spare = NULL;
+  s->first_num = 0;
+  s->blocks_used = 0;
+  s->block_next = 0;
+  
+  s->filename = filename;
+  s->err = mpc_lerr_fail(s, mpc_state_invalid(), "Unknown Error");
 }
 
-static void mpc_stack_err(mpc_stack_t *s, mpc_err_t* e) {
-  mpc_err_t *errs[2];
-  errs[0] = s->err;
-  errs[1] = e;
-  s->err = mpc_err_or(errs, 2);
+static void mpc_stack_clear(mpc_stack_t *s) {
+  int j;
+  for (j = 0; j < s->blocks_num; j++) { free(s->blocks[j]); }
+  free(s->blocks);
+  free(s->parsers);
+  free(s->states);
+  free(s->results);
+  free(s->returns);
+}
+
+static void mpc_stack_err(mpc_stack_t *s, mpc_lerr_t* e) {
+  s->err = mpc_lerr_or(s, s->err, e);
 }
 
 static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
@@ -778,18 +1088,11 @@ static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
   
   if (success) {
     r->output = s->results[0].output;
-    mpc_err_delete(s->err);
   } else {
     mpc_stack_err(s, s->results[0].error);
-    r->error = s->err;
+    r->error = mpc_lerr_build(s->filename, s->err);
   }
   
-  free(s->parsers);
-  free(s->states);
-  free(s->results);
-  free(s->returns);
-  free(s);
-  
   return success;
 }
 
@@ -801,15 +1104,7 @@ static void mpc_stack_set_state(mpc_stack_t *s, int x) {
 
 static void mpc_stack_parsers_reserve_more(mpc_stack_t *s) {
   if (s->parsers_num > s->parsers_slots) {
-    s->parsers_slots = ceil((s->parsers_slots+1) * 1.5);
-    s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
-    s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
-  }
-}
-
-static void mpc_stack_parsers_reserve_less(mpc_stack_t *s) {
-  if (s->parsers_slots > pow(s->parsers_num+1, 1.5)) {
-    s->parsers_slots = floor((s->parsers_slots-1) * (1.0/1.5));
+    s->parsers_slots = s->parsers_slots ? s->parsers_slots * 2 : 64;
     s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
     s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
   }
@@ -826,7 +1121,6 @@ static void mpc_stack_popp(mpc_stack_t *s, mpc_parser_t **p, int *st) {
   *p = s->parsers[s->parsers_num-1];
   *st = s->states[s->parsers_num-1];
   s->parsers_num--;
-  mpc_stack_parsers_reserve_less(s);
 }
 
 static void mpc_stack_peepp(mpc_stack_t *s, mpc_parser_t **p, int *st) {
@@ -840,57 +1134,48 @@ static int mpc_stack_empty(mpc_stack_t *s) {
 
 /* Stack Result Stuff */
 
-static mpc_result_t mpc_result_err(mpc_err_t *e) {
-  mpc_result_t r;
+static mpc_stack_result_t mpc_result_err(mpc_lerr_t *e) {
+  mpc_stack_result_t r;
   r.error = e;
   return r;
 }
 
-static mpc_result_t mpc_result_out(mpc_val_t *x) {
-  mpc_result_t r;
+static mpc_stack_result_t mpc_result_out(mpc_val_t *x) {
+  mpc_stack_result_t r;
   r.output = x;
   return r;
 }
 
 static void mpc_stack_results_reserve_more(mpc_stack_t *s) {
   if (s->results_num > s->results_slots) {
-    s->results_slots = ceil((s->results_slots + 1) * 1.5);
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
+    s->results_slots = s->results_slots ? s->results_slots * 2 : 64;
+    s->results = realloc(s->results, sizeof(mpc_stack_result_t) * s->results_slots);
     s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
   }
 }
 
-static void mpc_stack_results_reserve_less(mpc_stack_t *s) {
-  if ( s->results_slots > pow(s->results_num+1, 1.5)) {
-    s->results_slots = floor((s->results_slots-1) * (1.0/1.5));
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
-    s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
-  }
-}
-
-static void mpc_stack_pushr(mpc_stack_t *s, mpc_result_t x, int r) {
+static void mpc_stack_pushr(mpc_stack_t *s, mpc_stack_result_t x, int r) {
   s->results_num++;
   mpc_stack_results_reserve_more(s);
   s->results[s->results_num-1] = x;
   s->returns[s->results_num-1] = r;
 }
 
-static int mpc_stack_popr(mpc_stack_t *s, mpc_result_t *x) {
+static int mpc_stack_popr(mpc_stack_t *s, mpc_stack_result_t *x) {
   int r;
   *x = s->results[s->results_num-1];
   r = s->returns[s->results_num-1];
   s->results_num--;
-  mpc_stack_results_reserve_less(s);
   return r;
 }
 
-static int mpc_stack_peekr(mpc_stack_t *s, mpc_result_t *x) {
+static int mpc_stack_peekr(mpc_stack_t *s, mpc_stack_result_t *x) {
   *x = s->results[s->results_num-1];
   return s->returns[s->results_num-1];
 }
 
 static void mpc_stack_popr_err(mpc_stack_t *s, int n) {
-  mpc_result_t x;
+  mpc_stack_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     mpc_stack_err(s, x.error);
@@ -899,7 +1184,7 @@ static void mpc_stack_popr_err(mpc_stack_t *s, int n) {
 }
 
 static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
-  mpc_result_t x;
+  mpc_stack_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     ds[n-1](x.output);
@@ -908,7 +1193,7 @@ static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
 }
 
 static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
-  mpc_result_t x;
+  mpc_stack_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     dx(x.output);
@@ -917,7 +1202,7 @@ static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
 }
 
 static void mpc_stack_popr_n(mpc_stack_t *s, int n) {
-  mpc_result_t x;
+  mpc_stack_result_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     n--;
@@ -930,12 +1215,416 @@ static mpc_val_t *mpc_stack_merger_out(mpc_stack_t *s, int n, mpc_fold_t f) {
   return x;
 }
 
-static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
-  mpc_err_t *x = mpc_err_or((mpc_err_t**)(&s->results[s->results_num-n]), n);
+static mpc_lerr_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
+  int j;
+  mpc_lerr_t *x = s->results[s->results_num-n].error;
+  for (j = 1; j < n; j++) {
+    x = mpc_lerr_or(s, x, s->results[s->results_num-n+j].error);
+  }
   mpc_stack_popr_n(s, n);
   return x;
 }
 
+/*
+** Packrat Memo
+**
+** With a memo attached to the input, each named
+** parser that fails records its error against the
+** position and previous character it started at,
+** so that when backtracking tries it there again
+** the failure is replayed rather than re-parsed.
+**
+** Errors collected along the way by `many` and
+** `maybe` are kept with the entry and merged back
+** in on a hit, so messages are exactly as they
+** would have been without the memo.
+**
+** Results belong to whoever consumes them, so a
+** success is only recorded when the memo has a
+** `copy` function. The first success of a parser
+** at a place only marks it as seen, and the second
+** keeps a copy of the result and the state the
+** parser ended in. Grammars that never go back
+** over a rule then copy nothing, and any other
+** rule is still parsed at most twice at a place.
+** Each hit hands out another copy and moves the
+** input straight to the end state.
+*/
+
+enum {
+  MPC_MEMO_MISS    = 0,
+  MPC_MEMO_SUCCESS = 1,
+  MPC_MEMO_FAILURE = 2,
+  MPC_MEMO_SEEN    = 3
+};
+
+typedef struct {
+  mpc_parser_t *parser;
+  mpc_stack_result_t result;
+  mpc_lerr_t *soft;
+  mpc_state_t end;
+  int pos;
+  char last;
+  char end_last;
+  char kind;
+} mpc_memo_entry_t;
+
+typedef struct {
+  mpc_parser_t *parser;
+  int depth;
+  int pos;
+  char last;
+  int seen;
+  mpc_lerr_t *soft;
+} mpc_memo_frame_t;
+
+struct mpc_packrat_t {
+  mpc_memo_t *stats;
+  size_t used;
+  int slots_num;
+  int entries_num;
+  mpc_memo_entry_t *slots;
+  int frames_num;
+  int frames_slots;
+  mpc_memo_frame_t *frames;
+};
+
+static void mpc_packrat_init(mpc_packrat_t *m, mpc_memo_t *stats) {
+  m->stats = stats;
+  m->used = 0;
+  m->slots_num = 0;
+  m->entries_num = 0;
+  m->slots = NULL;
+  m->frames_num = 0;
+  m->frames_slots = 0;
+  m->frames = NULL;
+}
+
+static void mpc_packrat_clear(mpc_packrat_t *m) {
+  int j;
+  for (j = 0; j < m->slots_num; j++) {
+    if (m->slots[j].parser && m->slots[j].kind == MPC_MEMO_SUCCESS) { m->stats->del(m->slots[j].result.output); }
+  }
+  free(m->slots);
+  free(m->frames);
+}
+
+static unsigned long mpc_packrat_hash(mpc_parser_t *p, int pos, char last) {
+  unsigned long h = (unsigned long)(size_t)p;
+  h = (h ^ (h >> 4)) * 2654435761UL;
+  h ^= (unsigned long)pos * 40503UL + (unsigned char)last;
+  return h ^ (h >> 16);
+}
+
+static mpc_memo_entry_t *mpc_packrat_slot(mpc_memo_entry_t *slots, int slots_num, mpc_parser_t *p, int pos, char last) {
+  unsigned long j = mpc_packrat_hash(p, pos, last) & (slots_num - 1);
+  while (slots[j].parser &&
+    !(slots[j].parser == p && slots[j].pos == pos && slots[j].last == last)) {
+    j = (j + 1) & (slots_num - 1);
+  }
+  return &slots[j];
+}
+
+static int mpc_packrat_grow(mpc_packrat_t *m) {
+  
+  int j, slots_num = m->slots_num ? m->slots_num * 2 : 1024;
+  size_t more = sizeof(mpc_memo_entry_t) * (slots_num - m->slots_num);
+  mpc_memo_entry_t *slots;
+  
+  if (m->used + more > m->stats->limit) { return 0; }
+  
+  slots = calloc(slots_num, sizeof(mpc_memo_entry_t));
+  for (j = 0; j < m->slots_num; j++) {
+    if (m->slots[j].parser) {
+      *mpc_packrat_slot(slots, slots_num, m->slots[j].parser, m->slots[j].pos, m->slots[j].last) = m->slots[j];
+    }
+  }
+  
+  free(m->slots);
+  m->slots = slots;
+  m->slots_num = slots_num;
+  m->used += more;
+  if (m->used > m->stats->peak) { m->stats->peak = m->used; }
+  return 1;
+}
+
+/*
+** Records how the parser of frame `f` ended, as
+** one of the kinds above. A failure keeps its
+** error `r`, and a success its result `r` along
+** with the state of `i` it ended in.
+*/
+
+static void mpc_packrat_store(mpc_packrat_t *m, mpc_stack_t *stk, mpc_input_t *i, mpc_memo_frame_t *f, int kind, mpc_stack_result_t r, mpc_lerr_t *soft) {
+  
+  mpc_memo_entry_t *e;
+  mpc_val_t *output = NULL;
+  size_t size = 0;
+  
+  if ((m->entries_num + 1) * 2 > m->slots_num && !mpc_packrat_grow(m)) {
+    m->stats->dropped++;
+    return;
+  }
+  
+  if (kind == MPC_MEMO_FAILURE) { size += sizeof(mpc_lerr_t) * (mpc_lerr_count(r.error) + mpc_lerr_count(soft)); }
+  if (kind == MPC_MEMO_SUCCESS) {
+    size += sizeof(mpc_lerr_t) * mpc_lerr_count(soft);
+    output = m->stats->copy(r.output, &size);
+  }
+  
+  if (m->used + size > m->stats->limit) {
+    if (output) { m->stats->del(output); }
+    m->stats->dropped++;
+    return;
+  }
+  
+  /* a success seen once before is stored again, now with its result */
+  e = mpc_packrat_slot(m->slots, m->slots_num, f->parser, f->pos, f->last);
+  if (!e->parser) { m->entries_num++; }
+  e->parser = f->parser;
+  e->pos = f->pos;
+  e->last = f->last;
+  e->kind = kind;
+  if (kind == MPC_MEMO_FAILURE) { e->result.error = mpc_lerr_copy(stk, r.error); }
+  if (kind == MPC_MEMO_SUCCESS) { e->result.output = output; }
+  e->soft = kind == MPC_MEMO_SEEN ? NULL : mpc_lerr_copy(stk, soft);
+  e->end = i->state;
+  e->end_last = i->last;
+  
+  m->used += size;
+  if (m->used > m->stats->peak) { m->stats->peak = m->used; }
+  if (kind != MPC_MEMO_SEEN) { m->stats->stored++; }
+}
+
+/*
+** Called as a named parser is entered. On a hit the
+** recorded result is put in `r` and its kind is
+** returned, otherwise a frame is pushed to watch
+** the parser until it returns.
+*/
+
+static int mpc_packrat_enter(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *p, mpc_stack_result_t *r) {
+  
+  mpc_packrat_t *m = i->memo;
+  mpc_memo_entry_t *e = NULL;
+  mpc_memo_frame_t *f;
+  size_t size = 0;
+  
+  m->stats->lookups++;
+  
+  if (m->slots_num) {
+    e = mpc_packrat_slot(m->slots, m->slots_num, p, i->state.pos, i->last);
+    if (e->parser && e->kind != MPC_MEMO_SEEN) {
+      m->stats->hits++;
+      mpc_stack_err(stk, mpc_lerr_copy(stk, e->soft));
+      if (e->kind == MPC_MEMO_FAILURE) {
+        r->error = mpc_lerr_copy(stk, e->result.error);
+      } else {
+        r->output = m->stats->copy(e->result.output, &size);
+        i->state = e->end;
+        i->last = e->end_last;
+      }
+      return e->kind;
+    }
+  }
+  
+  if (m->frames_num == m->frames_slots) {
+    m->frames_slots = m->frames_slots ? m->frames_slots * 2 : 16;
+    m->frames = realloc(m->frames, sizeof(mpc_memo_frame_t) * m->frames_slots);
+  }
+  
+  f = &m->frames[m->frames_num++];
+  f->parser = p;
+  f->depth = stk->parsers_num - 1;
+  f->pos = i->state.pos;
+  f->last = i->last;
+  f->seen = e && e->parser;
+  f->soft = stk->err;
+  stk->err = mpc_lerr_fail(stk, mpc_state_invalid(), "Unknown Error");
+  
+  return MPC_MEMO_MISS;
+}
+
+/* Called after any parser returns, with its result on top */
+
+static void mpc_packrat_leave(mpc_input_t *i, mpc_stack_t *stk) {
+  
+  mpc_packrat_t *m = i->memo;
+  mpc_memo_frame_t *f;
+  
+  if (!m || m->frames_num == 0) { return; }
+  
+  f = &m->frames[m->frames_num-1];
+  if (f->depth != stk->parsers_num) { return; }
+  m->frames_num--;
+  
+  if (!stk->returns[stk->results_num-1]) {
+    if (i->state.pos == f->pos) {
+      mpc_packrat_store(m, stk, i, f, MPC_MEMO_FAILURE, stk->results[stk->results_num-1], stk->err);
+    }
+  } else if (m->stats->copy && i->type == MPC_INPUT_STRING) {
+    mpc_packrat_store(m, stk, i, f, f->seen ? MPC_MEMO_SUCCESS : MPC_MEMO_SEEN,
+      stk->results[stk->results_num-1], stk->err);
+  }
+  
+  stk->err = mpc_lerr_or(stk, f->soft, stk->err);
+}
+
+/*
+** Repeating a single character parser into a
+** string is what regex and token grammars spend
+** most of their time doing. Rather than have each
+** character allocate a string only to be folded
+** back together, such runs are matched directly
+** and the result is copied out once, as a slice
+** of string input or from a buffer for streams.
+*/
+
+static int mpc_parser_primitive(mpc_parser_t *p) {
+  return p->type >= MPC_TYPE_ANY && p->type <= MPC_TYPE_SATISFY;
+}
+
+static int mpc_repeat_primitive(mpc_parser_t *p) {
+  mpc_parser_t *x = p->data.repeat.x;
+  if (p->data.repeat.f != mpcf_strfold) { return 0; }
+  if (x->type == MPC_TYPE_EXPECT) { x = x->data.expect.x; }
+  return mpc_parser_primitive(x);
+}
+
+static int mpc_input_primitive(mpc_input_t *i, mpc_parser_t *p) {
+  switch (p->type) {
+    case MPC_TYPE_ANY:     return mpc_input_any(i, NULL);
+    case MPC_TYPE_SINGLE:  return mpc_input_char(i, p->data.single.x, NULL);
+    case MPC_TYPE_RANGE:   return mpc_input_range(i, p->data.range.x, p->data.range.y, NULL);
+    case MPC_TYPE_ONEOF:   return mpc_input_set(i, p->data.set.bits, NULL);
+    case MPC_TYPE_NONEOF:  return mpc_input_set(i, p->data.set.bits, NULL);
+    case MPC_TYPE_SATISFY: return mpc_input_satisfy(i, p->data.satisfy.f, NULL);
+    default: return 0;
+  }
+}
+
+/*
+** Folding single characters with `mpcf_strfold`
+** drops any NUL characters, so copies of input
+** that stand in for such a fold drop them too.
+*/
+
+static char *mpc_input_slice(const char *s, size_t len) {
+  size_t j = 0, k;
+  char *o = malloc(len + 1);
+  if (memchr(s, '\0', len) == NULL) {
+    memcpy(o, s, len);
+    j = len;
+  } else {
+    for (k = 0; k < len; k++) {
+      if (s[k] != '\0') { o[j++] = s[k]; }
+    }
+  }
+  o[j] = '\0';
+  return o;
+}
+
+/*
+** Moves string input on over `k` characters known
+** to match, as `mpc_input_success` would for each.
+*/
+
+static void mpc_input_skip(mpc_input_t *i, size_t k) {
+  
+  const char *s = i->string + i->state.pos;
+  size_t j;
+  
+  for (j = 0; j < k; j++) {
+    i->state.col++;
+    if (s[j] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+  
+  if (k > 0) { i->last = s[k-1]; }
+  i->state.pos += (int)k;
+}
+
+static char *mpc_input_run(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *x, int *n, mpc_lerr_t **e) {
+  
+  mpc_parser_t *y = x->type == MPC_TYPE_EXPECT ? x->data.expect.x : x;
+  long start = i->state.pos;
+  size_t len = 0, cap = 0;
+  char *buffer = NULL;
+  
+  *n = 0;
+  
+  if (i->type == MPC_INPUT_STRING &&
+     (y->type == MPC_TYPE_ONEOF || y->type == MPC_TYPE_NONEOF)) {
+    while ((size_t)(start + *n) < i->length &&
+           mpc_set_has(y->data.set.bits, i->string[start + *n])) {
+      (*n)++;
+    }
+    mpc_input_skip(i, (size_t)*n);
+  }
+  
+  while (mpc_input_primitive(i, y)) {
+    if (i->type != MPC_INPUT_STRING) {
+      if (len + 1 >= cap) {
+        cap = cap ? cap * 2 : 64;
+        buffer = realloc(buffer, cap);
+      }
+      if (i->last != '\0') { buffer[len++] = i->last; }
+    }
+    (*n)++;
+  }
+  
+  if (x->type == MPC_TYPE_EXPECT) {
+    *e = mpc_lerr_new(stk, i->state, x->data.expect.m, mpc_input_peekc(i));
+  } else {
+    *e = mpc_lerr_fail(stk, i->state, "Incorrect Input");
+  }
+  
+  if (i->type == MPC_INPUT_STRING) {
+    return mpc_input_slice(i->string + start, (size_t)(i->state.pos - start));
+  }
+  
+  if (buffer == NULL) { buffer = malloc(1); }
+  buffer[len] = '\0';
+  return buffer;
+}
+
+/*
+** Regex tables, built further down, give for each
+** state and next character either the next state
+** or how the match ends. The end of input is one
+** more column after the 256 characters.
+*/
+
+enum {
+  MPC_DFA_FAIL  = -1,
+  MPC_DFA_BAIL  = -2,
+  MPC_DFA_DONE  = -3,
+  MPC_DFA_EOI   = 256,
+  MPC_DFA_WIDTH = 257
+};
+
+static int mpc_input_dfa(mpc_input_t *i, const int *table, char **o) {
+  
+  const char *s = i->string + i->state.pos;
+  size_t len = i->length - (size_t)i->state.pos;
+  size_t k = 0;
+  int q = 0;
+  
+  while (1) {
+    q = table[q * MPC_DFA_WIDTH + (k < len ? (unsigned char)s[k] : MPC_DFA_EOI)];
+    if (q < 0) { break; }
+    k++;
+  }
+  
+  if (q != MPC_DFA_DONE) { return q; }
+  
+  mpc_input_skip(i, k);
+  *o = mpc_input_slice(s, k);
+  return q;
+}
+
 /*
 ** This is rather pleasant. The core parsing routine
 ** is written in about 200 lines of C.
@@ -958,28 +1647,36 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
 */
 
 #define MPC_CONTINUE(st, x) mpc_stack_set_state(stk, st); mpc_stack_pushp(stk, x); continue
-#define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); continue
-#define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); continue
-#define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
+#define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); mpc_packrat_leave(i, stk); continue
+#define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); mpc_packrat_leave(i, stk); continue
+#define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_lerr_fail(stk, i->state, "Incorrect Input")); }
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+static int mpc_parse_loop(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *init, mpc_result_t *final) {
   
   /* Stack */
   int st = 0;
   mpc_parser_t *p = NULL;
-  mpc_stack_t *stk = mpc_stack_new(i->filename);
   
   /* Variables */
   char *s;
-  mpc_result_t r;
+  int n;
+  mpc_lerr_t *e;
+  mpc_stack_result_t r;
 
   /* Go! */
+  mpc_stack_reset(stk, i->filename);
   mpc_stack_pushp(stk, init);
   
   while (!mpc_stack_empty(stk)) {
     
     mpc_stack_peepp(stk, &p, &st);
     
+    if (st == 0 && i->memo && p->name && i->backtrack > 0) {
+      n = mpc_packrat_enter(i, stk, p, &r);
+      if (n == MPC_MEMO_SUCCESS) { MPC_SUCCESS(r.output); }
+      if (n == MPC_MEMO_FAILURE) { MPC_FAILURE(r.error); }
+    }
+    
     switch (p->type) {
       
       /* Basic Parsers */
@@ -987,16 +1684,16 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       case MPC_TYPE_ANY:       MPC_PRIMATIVE(s, mpc_input_any(i, &s));
       case MPC_TYPE_SINGLE:    MPC_PRIMATIVE(s, mpc_input_char(i, p->data.single.x, &s));
       case MPC_TYPE_RANGE:     MPC_PRIMATIVE(s, mpc_input_range(i, p->data.range.x, p->data.range.y, &s));
-      case MPC_TYPE_ONEOF:     MPC_PRIMATIVE(s, mpc_input_oneof(i, p->data.string.x, &s));
-      case MPC_TYPE_NONEOF:    MPC_PRIMATIVE(s, mpc_input_noneof(i, p->data.string.x, &s));
+      case MPC_TYPE_ONEOF:     MPC_PRIMATIVE(s, mpc_input_set(i, p->data.set.bits, &s));
+      case MPC_TYPE_NONEOF:    MPC_PRIMATIVE(s, mpc_input_set(i, p->data.set.bits, &s));
       case MPC_TYPE_SATISFY:   MPC_PRIMATIVE(s, mpc_input_satisfy(i, p->data.satisfy.f, &s));
       case MPC_TYPE_STRING:    MPC_PRIMATIVE(s, mpc_input_string(i, p->data.string.x, &s));
       
       /* Other parsers */
       
-      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Parser Undefined!"));      
+      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_lerr_fail(stk, i->state, "Parser Undefined!"));      
       case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i->filename, i->state, p->data.fail.m));
+      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_lerr_fail(stk, i->state, p->data.fail.m));
       case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
       case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
       case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_state_copy(i->state));
@@ -1005,7 +1702,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (mpc_input_anchor(i, p->data.anchor.f)) {
           MPC_SUCCESS(NULL);
         } else {
-          MPC_FAILURE(mpc_err_new(i->filename, i->state, "anchor", mpc_input_peekc(i)));
+          MPC_FAILURE(mpc_lerr_new(stk, i->state, "anchor", mpc_input_peekc(i)));
         }
       
       /* Application Parsers */
@@ -1016,8 +1713,8 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (mpc_stack_popr(stk, &r)) {
             MPC_SUCCESS(r.output);
           } else {
-            mpc_err_delete(r.error); 
-            MPC_FAILURE(mpc_err_new(i->filename, i->state, p->data.expect.m, mpc_input_peekc(i)));
+            mpc_lerr_delete(stk, r.error); 
+            MPC_FAILURE(mpc_lerr_new(stk, i->state, p->data.expect.m, mpc_input_peekc(i)));
           }
         }
       
@@ -1046,6 +1743,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 1) {
           mpc_input_backtrack_enable(i);
           mpc_stack_popp(stk, &p, &st);
+          mpc_packrat_leave(i, stk);
           continue;
         }
       
@@ -1059,7 +1757,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (mpc_stack_popr(stk, &r)) {
             mpc_input_rewind(i);
             p->data.not.dx(r.output);
-            MPC_FAILURE(mpc_err_new(i->filename, i->state, "opposite", mpc_input_peekc(i)));
+            MPC_FAILURE(mpc_lerr_new(stk, i->state, "opposite", mpc_input_peekc(i)));
           } else {
             mpc_input_unmark(i);
             mpc_stack_err(stk, r.error);
@@ -1081,6 +1779,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       /* Repeat Parsers */
       
       case MPC_TYPE_MANY:
+        if (st == 0 && mpc_repeat_primitive(p)) {
+          s = mpc_input_run(i, stk, p->data.repeat.x, &n, &e);
+          mpc_stack_err(stk, e);
+          MPC_SUCCESS(s);
+        }
         if (st == 0) { MPC_CONTINUE(st+1, p->data.repeat.x); }
         if (st >  0) {
           if (mpc_stack_peekr(stk, &r)) {
@@ -1093,6 +1796,12 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         }
       
       case MPC_TYPE_MANY1:
+        if (st == 0 && mpc_repeat_primitive(p)) {
+          s = mpc_input_run(i, stk, p->data.repeat.x, &n, &e);
+          if (n == 0) { free(s); MPC_FAILURE(mpc_lerr_repeat(stk, e, -1)); }
+          mpc_stack_err(stk, e);
+          MPC_SUCCESS(s);
+        }
         if (st == 0) { MPC_CONTINUE(st+1, p->data.repeat.x); }
         if (st >  0) {
           if (mpc_stack_peekr(stk, &r)) {
@@ -1100,7 +1809,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             if (st == 1) {
               mpc_stack_popr(stk, &r);
-              MPC_FAILURE(mpc_err_many1(r.error));
+              MPC_FAILURE(mpc_lerr_repeat(stk, r.error, -1));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
@@ -1119,7 +1828,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
               mpc_stack_popr(stk, &r);
               mpc_stack_popr_out_single(stk, st-1, p->data.repeat.dx);
               mpc_input_rewind(i);
-              MPC_FAILURE(mpc_err_count(r.error, p->data.repeat.n));
+              MPC_FAILURE(mpc_lerr_repeat(stk, r.error, p->data.repeat.n));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
@@ -1162,11 +1871,28 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, p->data.and.f)); }
         }
       
+      /* Regex Tables */
+      
+      case MPC_TYPE_DFA:
+        if (st == 0 && i->type == MPC_INPUT_STRING && !i->exact && i->backtrack > 0) {
+          n = mpc_input_dfa(i, p->data.dfa.table, &s);
+          if (n == MPC_DFA_DONE) { i->dfa_used = 1; MPC_SUCCESS(s); }
+          if (n == MPC_DFA_FAIL) { i->dfa_used = 1; MPC_FAILURE(mpc_lerr_fail(stk, i->state, "Incorrect Input")); }
+        }
+        if (st == 0) { MPC_CONTINUE(1, p->data.dfa.x); }
+        if (st == 1) {
+          if (mpc_stack_popr(stk, &r)) {
+            MPC_SUCCESS(r.output);
+          } else {
+            MPC_FAILURE(r.error);
+          }
+        }
+      
       /* End */
       
       default:
         
-        MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Unknown Parser Type Id!"));
+        MPC_FAILURE(mpc_lerr_fail(stk, i->state, "Unknown Parser Type Id!"));
     }
   }
   
@@ -1179,14 +1905,140 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 #undef MPC_FAILURE
 #undef MPC_PRIMATIVE
 
+/*
+** Regexes matched by their tables record no errors,
+** so a parse which used them and failed is run once
+** more without them to get the error it would have
+** given. Any memo is emptied first, as what it has
+** recorded is missing the same errors.
+*/
+
+static int mpc_parse_run(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *init, mpc_result_t *final) {
+  
+  int x;
+  mpc_state_t start = i->state;
+  char last = i->last;
+  
+  i->dfa_used = 0;
+  x = mpc_parse_loop(i, stk, init, final);
+  if (x || !i->dfa_used) { return x; }
+  
+  mpc_err_delete(final->error);
+  
+  i->state = start;
+  i->last = last;
+  i->exact = 1;
+  
+  if (i->memo) {
+    mpc_memo_t *stats = i->memo->stats;
+    mpc_packrat_clear(i->memo);
+    mpc_packrat_init(i->memo, stats);
+  }
+  
+  x = mpc_parse_loop(i, stk, init, final);
+  i->exact = 0;
+  return x;
+}
+
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+  int x;
+  mpc_stack_t *stk = malloc(sizeof(mpc_stack_t));
+  mpc_stack_init(stk);
+  x = mpc_parse_run(i, stk, init, final);
+  mpc_stack_clear(stk);
+  free(stk);
+  return x;
+}
+
+/*
+** A context holds on to the parse stack and the
+** input marks between parses, so that a program
+** parsing many small strings, such as the lines
+** of a prompt, allocates them only once.
+*/
+
+struct mpc_context_t {
+  mpc_stack_t stack;
+  int marks_slots;
+  mpc_state_t *marks;
+  char *lasts;
+  mpc_memo_t *memo;
+};
+
+mpc_context_t *mpc_context_new(void) {
+  mpc_context_t *c = malloc(sizeof(mpc_context_t));
+  mpc_stack_init(&c->stack);
+  c->marks_slots = 0;
+  c->marks = NULL;
+  c->lasts = NULL;
+  c->memo = NULL;
+  return c;
+}
+
+void mpc_context_delete(mpc_context_t *c) {
+  mpc_stack_clear(&c->stack);
+  free(c->marks);
+  free(c->lasts);
+  free(c);
+}
+
+void mpc_context_memo(mpc_context_t *c, mpc_memo_t *m) {
+  c->memo = m;
+}
+
+int mpc_nparse_context(mpc_context_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  
+  int x;
+  mpc_packrat_t memo;
+  mpc_input_t *i = mpc_input_new_string(filename, string, length);
+  
+  i->marks_slots = c->marks_slots;
+  i->marks = c->marks;
+  i->lasts = c->lasts;
+  
+  if (c->memo) {
+    mpc_packrat_init(&memo, c->memo);
+    i->memo = &memo;
+  }
+  
+  x = mpc_parse_run(i, &c->stack, p, r);
+  
+  if (c->memo) { mpc_packrat_clear(&memo); }
+  
+  c->marks_slots = i->marks_slots;
+  c->marks = i->marks;
+  c->lasts = i->lasts;
+  i->marks = NULL;
+  i->lasts = NULL;
+  
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_nparse(filename, string, strlen(string), p, r);
+}
+
+int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_input_t *i = mpc_input_new_string(filename, string);
+  mpc_input_t *i = mpc_input_new_string(filename, string, length);
   x = mpc_parse_input(i, p, r);
   mpc_input_delete(i);
   return x;
 }
 
+int mpc_nparse_memo(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r, mpc_memo_t *m) {
+  int x;
+  mpc_packrat_t memo;
+  mpc_input_t *i = mpc_input_new_string(filename, string, length);
+  mpc_packrat_init(&memo, m);
+  i->memo = &memo;
+  x = mpc_parse_input(i, p, r);
+  mpc_packrat_clear(&memo);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
@@ -1203,19 +2055,96 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
   return x;
 }
 
+/*
+** File contents are mapped where possible, or
+** else read in one go, so that files are parsed
+** through the string input rather than stdio.
+*/
+
+typedef struct {
+  char *string;
+  size_t length;
+  int mapped;
+} mpc_contents_t;
+
+static int mpc_contents_read(FILE *f, mpc_contents_t *c) {
+  
+  size_t size = 4096, n;
+  char *buffer;
+  long end;
+  
+  if (fseek(f, 0, SEEK_END) == 0 && (end = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+    size = (size_t)end + 1;
+  }
+  
+  buffer = malloc(size);
+  c->length = 0;
+  
+  while ((n = fread(buffer + c->length, 1, size - c->length, f)) > 0) {
+    c->length += n;
+    if (c->length == size) {
+      size *= 2;
+      buffer = realloc(buffer, size);
+    }
+  }
+  
+  if (ferror(f)) { free(buffer); return 0; }
+  
+  c->string = buffer;
+  c->mapped = 0;
+  return 1;
+}
+
+static int mpc_contents_open(const char *filename, mpc_contents_t *c) {
+  
+  FILE *f;
+  int res;
+  
+#ifdef MPC_MMAP
+  struct stat st;
+  void *data;
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) { return 0; }
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      close(fd);
+      c->string = data;
+      c->length = (size_t)st.st_size;
+      c->mapped = 1;
+      return 1;
+    }
+  }
+  close(fd);
+#endif
+  
+  f = fopen(filename, "rb");
+  if (f == NULL) { return 0; }
+  res = mpc_contents_read(f, c);
+  fclose(f);
+  return res;
+}
+
+static void mpc_contents_close(mpc_contents_t *c) {
+#ifdef MPC_MMAP
+  if (c->mapped) { munmap(c->string, c->length); return; }
+#endif
+  free(c->string);
+}
+
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   
-  FILE *f = fopen(filename, "rb");
+  mpc_contents_t c;
   int res;
   
-  if (f == NULL) {
+  if (!mpc_contents_open(filename, &c)) {
     r->output = NULL;
     r->error = mpc_err_fail(filename, mpc_state_new(), "Unable to open file!");
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
-  fclose(f);
+  res = mpc_nparse(filename, c.string, c.length, p, r);
+  mpc_contents_close(&c);
   return res;
 }
 
@@ -1256,6 +2185,9 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+      free(p->data.set.x); 
+      break;
+    
     case MPC_TYPE_STRING:
       free(p->data.string.x); 
       break;
@@ -1283,6 +2215,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
     
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      free(p->data.dfa.table);
+      break;
+    
     default: break;
   }
   
@@ -1328,6 +2265,89 @@ mpc_parser_t *mpc_new(const char *name) {
   return p;
 }
 
+/*
+** Copies the parts of a parser that would be freed
+** along with it. Retained parsers are shared by the
+** copy, just as they are by the original.
+*/
+
+static char *mpc_copy_string(const char *s) {
+  char *c = malloc(strlen(s) + 1);
+  strcpy(c, s);
+  return c;
+}
+
+static mpc_parser_t *mpc_copy(mpc_parser_t *a) {
+  
+  int i;
+  mpc_parser_t *p;
+  
+  if (a->retained) { return a; }
+  
+  p = malloc(sizeof(mpc_parser_t));
+  memcpy(p, a, sizeof(mpc_parser_t));
+  
+  switch (a->type) {
+    
+    case MPC_TYPE_FAIL: p->data.fail.m = mpc_copy_string(a->data.fail.m); break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      p->data.set.x = mpc_copy_string(a->data.set.x);
+      break;
+    
+    case MPC_TYPE_STRING: p->data.string.x = mpc_copy_string(a->data.string.x); break;
+    
+    case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
+    case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
+    case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      p->data.not.x = mpc_copy(a->data.not.x);
+      break;
+    
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpc_copy(a->data.expect.x);
+      p->data.expect.m = mpc_copy_string(a->data.expect.m);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.x = mpc_copy(a->data.repeat.x);
+      break;
+    
+    case MPC_TYPE_OR:
+      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.or.n; i++) {
+        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
+      }
+      break;
+    
+    case MPC_TYPE_AND:
+      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.and.n; i++) {
+        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
+      }
+      p->data.and.dxs = malloc((a->data.and.n > 0 ? a->data.and.n-1 : 0) * sizeof(mpc_dtor_t));
+      for (i = 0; i < a->data.and.n-1; i++) {
+        p->data.and.dxs[i] = a->data.and.dxs[i];
+      }
+      break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.table = malloc(sizeof(int) * MPC_DFA_WIDTH * a->data.dfa.n);
+      memcpy(p->data.dfa.table, a->data.dfa.table, sizeof(int) * MPC_DFA_WIDTH * a->data.dfa.n);
+      break;
+    
+    default: break;
+  }
+  
+  return p;
+}
+
 mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
   mpc_undefine_unretained(p, 1);
   p->type = MPC_TYPE_UNDEFINED;
@@ -1516,19 +2536,37 @@ mpc_parser_t *mpc_range(char s, char e) {
   return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
 
+/*
+** As the end of `s` is found by `strchr` just as
+** the characters are, NUL is a member of any set
+** from `mpc_oneof` and never of one from `mpc_noneof`.
+*/
+
+static void mpc_set_new(mpc_parser_t *p, const char *s, int comp) {
+  int j;
+  p->data.set.x = malloc(strlen(s) + 1);
+  strcpy(p->data.set.x, s);
+  memset(p->data.set.bits, 0, sizeof(p->data.set.bits));
+  p->data.set.bits[0] = 1;
+  for (; *s; s++) {
+    p->data.set.bits[(unsigned char)*s >> 3] |= 1 << ((unsigned char)*s & 7);
+  }
+  if (comp) {
+    for (j = 0; j < 32; j++) { p->data.set.bits[j] = ~p->data.set.bits[j]; }
+  }
+}
+
 mpc_parser_t *mpc_oneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  mpc_set_new(p, s, 0);
   return mpc_expectf(p, "one of '%s'", s);
 }
 
 mpc_parser_t *mpc_noneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  mpc_set_new(p, s, 1);
   return mpc_expectf(p, "one of '%s'", s);
 
 }
@@ -1942,34 +2980,53 @@ static char *mpc_re_range_escape_char(char c) {
   }
 }
 
+/*
+** Ranges are gathered into a string with its length
+** kept, which is then only used to build the set and
+** its message. A NUL would end the string, so is not
+** added.
+*/
+
+static void mpc_re_range_add(char **range, size_t *len, size_t *cap, const char *s, size_t n) {
+  size_t k;
+  for (k = 0; k < n; k++) {
+    if (s[k] == '\0') { continue; }
+    if (*len + 1 >= *cap) {
+      *cap *= 2;
+      *range = realloc(*range, *cap);
+    }
+    (*range)[(*len)++] = s[k];
+  }
+  (*range)[*len] = '\0';
+}
+
 static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
   mpc_parser_t *out;
-  char *range = calloc(1,1);
+  size_t len = 0, cap = 64;
+  char *range = calloc(1, cap);
   char *tmp = NULL;
   char *s = x;
-  char start, end;
-  int i, j;
+  char start, end, c;
+  int i, j, n;
   int comp = 0;
   
-  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '\0') { free(x); free(range); return mpc_fail("Invalid Regex Range Expression"); } 
   if (s[0] == '^' && 
-      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+      s[1] == '\0') { free(x); free(range); return mpc_fail("Invalid Regex Range Expression"); }
   
   if (s[0] == '^') { comp = 1;}
   
-  for (i = comp; i < strlen(s); i++){
+  n = (int)strlen(s);
+  for (i = comp; i < n; i++){
     
     /* Regex Range Escape */
     if (s[i] == '\\') {
       tmp = mpc_re_range_escape_char(s[i+1]);
       if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
+        mpc_re_range_add(&range, &len, &cap, tmp, strlen(tmp));
       } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];      
+        mpc_re_range_add(&range, &len, &cap, &s[i+1], 1);
       }
       i++;
     }
@@ -1977,24 +3034,20 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     /* Regex Range...Range */
     else if (s[i] == '-') {
       if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
+        mpc_re_range_add(&range, &len, &cap, "-", 1);
       } else {
         start = s[i-1]+1;
         end = s[i+1]-1;
         for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = j;
+          c = (char)j;
+          mpc_re_range_add(&range, &len, &cap, &c, 1);
         }        
       }
     }
     
     /* Regex Range Normal */
     else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
+      mpc_re_range_add(&range, &len, &cap, &s[i], 1);
     }
   
   }
@@ -2007,12 +3060,506 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
+/*
+** Regex Tables
+**
+** Most regexes can be matched with a table rather
+** than by stepping through their combinators. The
+** tree of combinators is built into a Thompson NFA,
+** and the states reached after each character are
+** found from it, as in the subset construction, to
+** give a table of the next state for each state and
+** character.
+**
+** But these regexes are not quite regular. A choice
+** takes the first branch that matches and repeats
+** are greedy and never give anything back. So each
+** split in the NFA is guarded by the characters on
+** which the combinators would go that way, and so
+** every subset of states has just the one in it.
+**
+** Looking one character ahead like this is exact up
+** until some branch or repeat fails after consuming
+** input, where the combinators would backtrack. The
+** table marks such places and the parse falls back
+** to the combinators there, as it does for regexes
+** using anchors or other constructs that the table
+** does not cover.
+*/
+
+enum {
+  MPC_NFA_CHAR  = 0,
+  MPC_NFA_SPLIT = 1,
+  MPC_NFA_BAIL  = 2,
+  MPC_NFA_FINAL = 3
+};
+
+enum {
+  MPC_NFA_STATES_MAX = 1024,
+  MPC_DFA_STATES_MAX = 256
+};
+
+enum {
+  MPC_DFA_NOTHING = 0,
+  MPC_DFA_EMPTY   = 1,
+  MPC_DFA_CONSUME = 2
+};
+
+typedef struct {
+  char type;
+  char inside;
+  int out[2];
+  char admit[MPC_DFA_WIDTH];
+} mpc_nfa_state_t;
+
+typedef struct {
+  int num;
+  int slots;
+  mpc_nfa_state_t *states;
+} mpc_nfa_t;
+
+static int mpc_dfa_primitive_has(mpc_parser_t *p, char x) {
+  switch (p->type) {
+    case MPC_TYPE_ANY:     return 1;
+    case MPC_TYPE_SINGLE:  return x == p->data.single.x;
+    case MPC_TYPE_RANGE:   return x >= p->data.range.x && x <= p->data.range.y;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:  return mpc_set_has(p->data.set.bits, x) != 0;
+    case MPC_TYPE_SATISFY: return p->data.satisfy.f(x);
+    default: return 0;
+  }
+}
+
+/*
+** What the combinators of `p` do when the next
+** character is `c`: fail without consuming it,
+** succeed without consuming it, or consume it.
+*/
+
+static int mpc_dfa_outcome(mpc_parser_t *p, int c) {
   
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
+  int j, o;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT: return mpc_dfa_outcome(p->data.expect.x, c);
+    case MPC_TYPE_LIFT:   return MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        o = mpc_dfa_outcome(p->data.and.xs[j], c);
+        if (o != MPC_DFA_EMPTY) { return o; }
+      }
+      return MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        o = mpc_dfa_outcome(p->data.or.xs[j], c);
+        if (o != MPC_DFA_NOTHING) { return o; }
+      }
+      return MPC_DFA_NOTHING;
+    
+    case MPC_TYPE_MAYBE:
+      o = mpc_dfa_outcome(p->data.not.x, c);
+      return o == MPC_DFA_CONSUME ? MPC_DFA_CONSUME : MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_MANY:
+      o = mpc_dfa_outcome(p->data.repeat.x, c);
+      return o == MPC_DFA_CONSUME ? MPC_DFA_CONSUME : MPC_DFA_EMPTY;
+    
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      o = mpc_dfa_outcome(p->data.repeat.x, c);
+      return o == MPC_DFA_CONSUME ? MPC_DFA_CONSUME : MPC_DFA_NOTHING;
+    
+    default:
+      if (c == MPC_DFA_EOI) { return MPC_DFA_NOTHING; }
+      return mpc_dfa_primitive_has(p, (char)c) ? MPC_DFA_CONSUME : MPC_DFA_NOTHING;
+  }
+  
+}
+
+/*
+** Only parsers that build their output by folding
+** up the characters they consume can be replaced by
+** a copy of the input matched. Repeats of anything
+** that may succeed without consuming never finish
+** with the combinators so are left to them.
+*/
+
+static int mpc_dfa_supported(mpc_parser_t *p) {
+  
+  int j, c;
+  mpc_parser_t *x;
+  
+  if (p->retained) { return 0; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+      return 1;
+    
+    case MPC_TYPE_EXPECT: return mpc_dfa_supported(p->data.expect.x);
+    case MPC_TYPE_LIFT:   return p->data.lift.lf == mpcf_ctor_str;
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0 || p->data.and.f != mpcf_strfold) { return 0; }
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_supported(p->data.and.xs[j])) { return 0; }
+      }
+      return 1;
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_supported(p->data.or.xs[j])) { return 0; }
+      }
+      return 1;
+    
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      return mpc_dfa_supported(p->data.not.x);
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      x = p->data.repeat.x;
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n < 1) { return 0; }
+      if (!mpc_dfa_supported(x)) { return 0; }
+      for (c = 0; c < MPC_DFA_WIDTH; c++) {
+        if (mpc_dfa_outcome(x, c) == MPC_DFA_EMPTY) { return 0; }
+      }
+      return 1;
+    
+    default: return 0;
+  }
+  
+}
+
+static int mpc_nfa_state(mpc_nfa_t *n, int type, int inside) {
+  
+  mpc_nfa_state_t *s;
+  
+  if (n->num == n->slots) {
+    n->slots = n->slots ? n->slots * 2 : 32;
+    n->states = realloc(n->states, sizeof(mpc_nfa_state_t) * n->slots);
+  }
+  
+  s = &n->states[n->num];
+  s->type = type;
+  s->inside = inside;
+  s->out[0] = -1;
+  s->out[1] = -1;
+  memset(s->admit, type == MPC_NFA_SPLIT, MPC_DFA_WIDTH);
+  return n->num++;
+}
+
+/*
+** A split which goes to `body` on the characters
+** it would consume, and otherwise to `other`.
+*/
+
+static int mpc_nfa_split(mpc_nfa_t *n, mpc_parser_t *body, int inside) {
+  int s = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+  int c;
+  for (c = 0; c < MPC_DFA_WIDTH; c++) {
+    n->states[s].admit[c] = mpc_dfa_outcome(body, c) == MPC_DFA_CONSUME;
+  }
+  return s;
+}
+
+/*
+** Builds the states for `p` and returns the first.
+** The last is returned in `end`, and is a plain
+** split to be pointed at whatever comes next. The
+** states of the branches and repeated parts, which
+** the combinators would backtrack out of, are each
+** marked as `inside`.
+*/
+
+static int mpc_nfa_build(mpc_nfa_t *n, mpc_parser_t *p, int inside, int *end);
+
+static int mpc_nfa_many(mpc_nfa_t *n, mpc_parser_t *x, int inside, int *end) {
+  int s = mpc_nfa_split(n, x, inside);
+  int e, b = mpc_nfa_build(n, x, 1, &e);
+  *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+  n->states[e].out[0] = s;
+  n->states[s].out[0] = b;
+  n->states[s].out[1] = *end;
+  return s;
+}
+
+static int mpc_nfa_build(mpc_nfa_t *n, mpc_parser_t *p, int inside, int *end) {
+  
+  int s, e, t, u, j, c;
+  
+  if (n->num > MPC_NFA_STATES_MAX) {
+    return *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+  }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT: return mpc_nfa_build(n, p->data.expect.x, inside, end);
+    case MPC_TYPE_LIFT:   return *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+    
+    case MPC_TYPE_AND:
+      s = mpc_nfa_build(n, p->data.and.xs[0], inside, &e);
+      for (j = 1; j < p->data.and.n; j++) {
+        t = mpc_nfa_build(n, p->data.and.xs[j], inside, &u);
+        n->states[e].out[0] = t;
+        e = u;
+      }
+      *end = e;
+      return s;
+    
+    case MPC_TYPE_OR:
+      *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+      s = t = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+      for (j = 0; j < p->data.or.n; j++) {
+        for (c = 0; c < MPC_DFA_WIDTH; c++) {
+          n->states[t].admit[c] = mpc_dfa_outcome(p->data.or.xs[j], c) != MPC_DFA_NOTHING;
+        }
+        u = mpc_nfa_build(n, p->data.or.xs[j], 1, &e);
+        n->states[e].out[0] = *end;
+        n->states[t].out[0] = u;
+        if (j < p->data.or.n-1) {
+          u = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+          n->states[t].out[1] = u;
+          t = u;
+        }
+      }
+      return s;
+    
+    case MPC_TYPE_MAYBE:
+      s = mpc_nfa_split(n, p->data.not.x, inside);
+      u = mpc_nfa_build(n, p->data.not.x, 1, &e);
+      *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+      n->states[s].out[0] = u;
+      n->states[s].out[1] = *end;
+      n->states[e].out[0] = *end;
+      return s;
+    
+    case MPC_TYPE_MANY:
+      return mpc_nfa_many(n, p->data.repeat.x, inside, end);
+    
+    case MPC_TYPE_MANY1:
+      s = mpc_nfa_build(n, p->data.repeat.x, inside, &e);
+      t = mpc_nfa_many(n, p->data.repeat.x, inside, end);
+      n->states[e].out[0] = t;
+      return s;
+    
+    /*
+    ** After its count `count` goes on trying to match
+    ** and fails if it can, so where it would try the
+    ** table gives up.
+    */
+    
+    case MPC_TYPE_COUNT:
+      s = mpc_nfa_build(n, p->data.repeat.x, inside, &e);
+      for (j = 1; j < p->data.repeat.n; j++) {
+        t = mpc_nfa_build(n, p->data.repeat.x, inside, &u);
+        n->states[e].out[0] = t;
+        e = u;
+      }
+      t = mpc_nfa_split(n, p->data.repeat.x, inside);
+      u = mpc_nfa_state(n, MPC_NFA_BAIL, inside);
+      *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+      n->states[e].out[0] = t;
+      n->states[t].out[0] = u;
+      n->states[t].out[1] = *end;
+      return s;
+    
+    default:
+      s = mpc_nfa_state(n, MPC_NFA_CHAR, inside);
+      for (c = 0; c < MPC_DFA_EOI; c++) {
+        n->states[s].admit[c] = mpc_dfa_primitive_has(p, (char)c);
+      }
+      *end = mpc_nfa_state(n, MPC_NFA_SPLIT, inside);
+      n->states[s].out[0] = *end;
+      return s;
+  }
+  
+}
+
+/*
+** Follows the NFA from state `s` with `c` as the
+** next character, giving the state reached after
+** consuming it or how the match ends. Getting stuck
+** inside something the combinators could backtrack
+** out of means that the table cannot say.
+*/
+
+static int mpc_nfa_step(mpc_nfa_t *n, int s, int c) {
+  
+  int k;
+  mpc_nfa_state_t *q;
+  
+  for (k = 0; k < n->num; k++) {
+    q = &n->states[s];
+    switch (q->type) {
+      case MPC_NFA_FINAL: return MPC_DFA_DONE;
+      case MPC_NFA_BAIL:  return MPC_DFA_BAIL;
+      case MPC_NFA_CHAR:
+        if (q->admit[c]) { return q->out[0]; }
+        return q->inside ? MPC_DFA_BAIL : MPC_DFA_FAIL;
+      default:
+        s = q->admit[c] ? q->out[0] : q->out[1];
+        if (s < 0) { return q->inside ? MPC_DFA_BAIL : MPC_DFA_FAIL; }
+    }
+  }
+  
+  return MPC_DFA_BAIL;
+}
+
+static int *mpc_dfa_table(mpc_nfa_t *n, int start, int *states) {
+  
+  int *table = NULL;
+  int *dfa = malloc(sizeof(int) * n->num);
+  int nfa[MPC_DFA_STATES_MAX];
+  int num = 1, q, c, t;
+  
+  for (q = 0; q < n->num; q++) { dfa[q] = -1; }
+  dfa[start] = 0;
+  nfa[0] = start;
+  
+  for (q = 0; q < num; q++) {
+    
+    table = realloc(table, sizeof(int) * MPC_DFA_WIDTH * (q+1));
+    
+    for (c = 0; c < MPC_DFA_WIDTH; c++) {
+      t = mpc_nfa_step(n, nfa[q], c);
+      if (t >= 0 && dfa[t] < 0) {
+        if (num == MPC_DFA_STATES_MAX) {
+          free(table);
+          free(dfa);
+          return NULL;
+        }
+        dfa[t] = num;
+        nfa[num++] = t;
+      }
+      table[q * MPC_DFA_WIDTH + c] = t >= 0 ? dfa[t] : t;
+    }
+  }
+  
+  free(dfa);
+  *states = num;
+  return table;
+}
+
+static mpc_parser_t *mpc_re_table(mpc_parser_t *x) {
+  
+  mpc_nfa_t n;
+  mpc_parser_t *p;
+  int start, end, final, states;
+  int *table = NULL;
+  
+  if (!mpc_dfa_supported(x)) { return x; }
+  
+  n.num = 0;
+  n.slots = 0;
+  n.states = NULL;
+  
+  start = mpc_nfa_build(&n, x, 0, &end);
+  final = mpc_nfa_state(&n, MPC_NFA_FINAL, 0);
+  n.states[end].out[0] = final;
+  
+  if (n.num <= MPC_NFA_STATES_MAX) { table = mpc_dfa_table(&n, start, &states); }
+  free(n.states);
+  
+  if (table == NULL) { return x; }
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = x;
+  p->data.dfa.n = states;
+  p->data.dfa.table = table;
+  return p;
+}
+
+/*
+** Regex Cache
+**
+** The grammar for regexes is built the first time it
+** is needed and then kept. Each pattern compiled is
+** kept too, under its string, so that compiling it
+** again, as `mpca_lang` does for every grammar with
+** the same token, is only a copy. Where threads are
+** available a lock guards both.
+*/
+
+#ifdef MPC_THREADS
+static pthread_mutex_t mpc_re_lock = PTHREAD_MUTEX_INITIALIZER;
+#define mpc_re_lock_take() pthread_mutex_lock(&mpc_re_lock)
+#define mpc_re_lock_give() pthread_mutex_unlock(&mpc_re_lock)
+#else
+#define mpc_re_lock_take()
+#define mpc_re_lock_give()
+#endif
+
+enum {
+  MPC_RE_CACHE_MAX = 4096
+};
+
+typedef struct {
+  char *re;
+  mpc_parser_t *p;
+} mpc_re_entry_t;
+
+static mpc_parser_t *mpc_re_grammar = NULL;
+static int mpc_re_cache_num = 0;
+static int mpc_re_cache_slots = 0;
+static mpc_re_entry_t *mpc_re_cache = NULL;
+
+static mpc_re_entry_t *mpc_re_cache_slot(mpc_re_entry_t *slots, int slots_num, const char *re) {
+  
+  unsigned long h = 5381;
+  const char *c;
+  
+  for (c = re; *c; c++) { h = h * 33 + (unsigned char)*c; }
+  h &= slots_num - 1;
+  
+  while (slots[h].re && strcmp(slots[h].re, re) != 0) {
+    h = (h + 1) & (slots_num - 1);
+  }
+  return &slots[h];
+}
+
+static int mpc_re_cache_add(const char *re, mpc_parser_t *p) {
+  
+  int j, slots_num;
+  mpc_re_entry_t *slots, *e;
+  
+  if (mpc_re_cache_num >= MPC_RE_CACHE_MAX) { return 0; }
+  
+  if ((mpc_re_cache_num + 1) * 4 > mpc_re_cache_slots * 3) {
+    slots_num = mpc_re_cache_slots ? mpc_re_cache_slots * 2 : 64;
+    slots = calloc(slots_num, sizeof(mpc_re_entry_t));
+    for (j = 0; j < mpc_re_cache_slots; j++) {
+      if (mpc_re_cache[j].re == NULL) { continue; }
+      *mpc_re_cache_slot(slots, slots_num, mpc_re_cache[j].re) = mpc_re_cache[j];
+    }
+    free(mpc_re_cache);
+    mpc_re_cache = slots;
+    mpc_re_cache_slots = slots_num;
+  }
+  
+  e = mpc_re_cache_slot(mpc_re_cache, mpc_re_cache_slots, re);
+  e->re = malloc(strlen(re) + 1);
+  strcpy(e->re, re);
+  e->p = p;
+  mpc_re_cache_num++;
+  return 1;
+}
+
+static mpc_parser_t *mpc_re_grammar_new(void) {
+  
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range; 
   
   Regex  = mpc_new("regex");
   Term   = mpc_new("term");
@@ -2049,9 +3596,18 @@ mpc_parser_t *mpc_re(const char *re) {
     mpcf_re_range
   ));
   
-  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+  return mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+}
+
+static mpc_parser_t *mpc_re_compile(const char *re) {
+  
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  
+  if (mpc_re_grammar == NULL) { mpc_re_grammar = mpc_re_grammar_new(); }
   
-  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
+  if(!mpc_parse("<mpc_re_compiler>", re, mpc_re_grammar, &r)) {
     err_msg = mpc_err_string(r.error);
     err_out = mpc_failf("Invalid Regex: %s", err_msg);
     mpc_err_delete(r.error);  
@@ -2059,10 +3615,33 @@ mpc_parser_t *mpc_re(const char *re) {
     r.output = err_out;
   }
   
-  mpc_delete(RegexEnclose);
-  mpc_cleanup(5, Regex, Term, Factor, Base, Range);
+  return mpc_re_table(r.output);
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  
+  mpc_parser_t *p;
+  mpc_re_entry_t *e;
+  
+  mpc_re_lock_take();
+  
+  if (mpc_re_cache_slots > 0) {
+    e = mpc_re_cache_slot(mpc_re_cache, mpc_re_cache_slots, re);
+    if (e->re) {
+      p = e->p;
+      mpc_re_lock_give();
+      return mpc_copy(p);
+    }
+  }
+  
+  p = mpc_re_compile(re);
+  if (!mpc_re_cache_add(re, p)) {
+    mpc_re_lock_give();
+    return p;
+  }
   
-  return r.output;
+  mpc_re_lock_give();
+  return mpc_copy(p);
   
 }
 
@@ -2257,13 +3836,22 @@ mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1)
 mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
-  char *x = calloc(1, 1);
+  
+  char *x;
+  size_t len = 0, l;
   int i;
+  
+  for (i = 0; i < n; i++) { len += strlen(xs[i]); }
+  
+  x = malloc(len + 1);
+  len = 0;
   for (i = 0; i < n; i++) {
-    x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
-    strcat(x, xs[i]);
+    l = strlen(xs[i]);
+    memcpy(x + len, xs[i], l);
+    len += l;
     free(xs[i]);
   }
+  x[len] = '\0';
   return x;
 }
 
@@ -2342,7 +3930,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.set.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
@@ -2351,7 +3939,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_NONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.set.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[^%s]", s);
@@ -2388,6 +3976,10 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     printf(")");
   }
   
+  if (p->type == MPC_TYPE_DFA) {
+    mpc_print_unretained(p->data.dfa.x, 0);
+  }
+  
   if (p->type == MPC_TYPE_AND) {
     printf("(");
     for(i = 0; i < p->data.and.n-1; i++) {
@@ -2491,6 +4083,38 @@ void mpc_ast_delete(mpc_ast_t *a) {
   
 }
 
+static mpc_ast_t *mpc_ast_copy_sized(mpc_ast_t *a, size_t *bytes) {
+  
+  int i;
+  mpc_ast_t *c;
+  
+  if (a == NULL) { return NULL; }
+  c = mpc_ast_new(a->tag, a->contents);
+  c->state = a->state;
+  c->children_num = a->children_num;
+  c->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    c->children[i] = mpc_ast_copy_sized(a->children[i], bytes);
+  }
+  
+  *bytes += sizeof(mpc_ast_t) + strlen(a->tag) + strlen(a->contents) + 2
+    + sizeof(mpc_ast_t*) * a->children_num;
+  return c;
+}
+
+static mpc_val_t *mpc_memo_ast_copy(mpc_val_t *x, size_t *bytes) {
+  return mpc_ast_copy_sized(x, bytes);
+}
+
+static void mpc_memo_ast_del(mpc_val_t *x) {
+  mpc_ast_delete(x);
+}
+
+void mpc_memo_ast(mpc_memo_t *m) {
+  m->copy = mpc_memo_ast_copy;
+  m->del = mpc_memo_ast_del;
+}
+
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
   free(a->children);
   free(a->tag);
@@ -3172,7 +4796,7 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   st.parsers = NULL;
   st.flags = flags;
   
-  i = mpc_input_new_string("<mpca_lang>", language);
+  i = mpc_input_new_string("<mpca_lang>", language, strlen(language));
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
@@ -3189,9 +4813,9 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   
   va_list va;
 
-  FILE *f = fopen(filename, "rb");
+  mpc_contents_t c;
   
-  if (f == NULL) {
+  if (!mpc_contents_open(filename, &c)) {
     return mpc_err_fail(filename, mpc_state_new(), "Unable to open file!");
   }
   
@@ -3202,14 +4826,14 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers = NULL;
   st.flags = flags;
   
-  i = mpc_input_new_file(filename, f);
+  i = mpc_input_new_string(filename, c.string, c.length);
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
   free(st.parsers);
   va_end(va);  
   
-  fclose(f);
+  mpc_contents_close(&c);
   
   return err;
 }
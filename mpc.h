@@ -60,10 +60,61 @@ struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Packrat Parsing
+**
+** Set `limit` to the bytes the memo of a single
+** parse may use, and pass the same struct to as
+** many parses as you like. The counting fields say
+** what the memo did, with `peak` the most bytes
+** it has held at once.
+**
+** Only failures are remembered unless `copy` and
+** `del` are set, in which case successes are too,
+** once a rule has succeeded twice at one place.
+** `copy` must add the bytes it allocates to
+** `bytes`. `mpc_memo_ast` sets them for grammars
+** whose results are ASTs, as with `mpca_lang`.
+*/
+
+typedef struct {
+  size_t limit;
+  size_t peak;
+  long lookups;
+  long hits;
+  long stored;
+  long dropped;
+  mpc_val_t *(*copy)(mpc_val_t *x, size_t *bytes);
+  void (*del)(mpc_val_t *x);
+} mpc_memo_t;
+
+void mpc_memo_ast(mpc_memo_t *m);
+
+int mpc_nparse_memo(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r, mpc_memo_t *m);
+
+/*
+** Parse Contexts
+**
+** A context keeps what a parse allocates so that
+** the next parse made with it can use it again.
+** It may be used for one parse at a time, and
+** with a memo attached parses are packrat.
+*/
+
+struct mpc_context_t;
+typedef struct mpc_context_t mpc_context_t;
+
+mpc_context_t *mpc_context_new(void);
+void mpc_context_delete(mpc_context_t *c);
+void mpc_context_memo(mpc_context_t *c, mpc_memo_t *m);
+
+int mpc_nparse_context(mpc_context_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
+
 /*
 ** Function Types
 */